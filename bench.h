@@ -0,0 +1,129 @@
+#ifndef LIBCHESSENGINE__BENCH_H
+#define LIBCHESSENGINE__BENCH_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "evaluation.h"
+#include "libchess/Position.h"
+#include "movepick.h"
+#include "search.h"
+#include "tt.h"
+
+namespace bench {
+
+static const int DEFAULT_DEPTH = 6;
+static const int DEFAULT_THREADS = 1;
+static const int DEFAULT_HASH_MB = 16;
+
+// Middlegames of every kind, a few tactical positions and some endgames
+inline const std::array<const char*, 23> POSITIONS{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r3k2r/p1pp1pb1/bn2Qnp1/2qPN3/1p2P3/2N5/PPPBBPPP/R3K2R b KQkq - 3 2",
+    "2kr3r/p1ppqpb1/bn2Qnp1/3PN3/1p2P3/2N5/PPPBBPPP/R3K2R b KQ - 3 2",
+    "rnb2k1r/pp1Pbppp/2p5/q7/2B5/8/PPPQNnPP/RNB1K2R w KQ - 3 9",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r6r/1b2k1bq/8/8/7B/8/8/R3K2R b KQ - 3 2",
+    "r1bqkbnr/pppppppp/n7/8/8/P7/1PPPPPPP/RNBQKBNR w KQkq - 2 2",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "2rq1rk1/1p3pbp/p1npbnp1/4p3/4P3/1NN1BP2/PPPQ2PP/2KR1B1R w - - 0 1",
+    "r1bq1rk1/1pp1bppp/p1np1n2/4p3/4P3/2N1B3/PPP1BPPP/R2Q1RK1 w - - 0 1",
+    "r1bq1r2/pppn1pbk/3p2np/3Pp1p1/2P1P3/2N2N1P/PP2BPP1/R1BQ1RK1 w - - 0 1",
+    "r2q1rk1/pp2bppp/2n1p3/3pP3/3P1P2/2N5/PPPQ2PP/R3KB1R w KQ - 0 1",
+    "r1bqk2r/1p2bppp/p1nppn2/8/3NP3/2N1B3/PPPQ1PPP/2KR1B1R w kq - 0 1",
+    "r1bq1k1r/pp1n1ppp/2pb4/3p4/3P1B2/2NBPN2/PPP3PP/R2Q1RK1 w - - 0 1",
+    "r4rk1/ppqb1ppp/2nbpn2/3p4/3P1B2/2NBPN2/PPPQ2PP/R4RK1 w - - 0 1",
+    "rnbq1k1r/pp3ppp/4pn2/2bp4/3P1B2/2N1PN2/PPPQ1PPP/R3KB1R w KQ - 0 1",
+    "r4rk1/1bqnbppp/pp1ppn2/8/2PNPP2/1PN1B3/PB3QPP/R4RK1 w - - 0 1",
+    "2r2rk1/1bqnbppp/pp1ppn2/8/2PNP3/1PN1BP2/PB3QPP/R4RK1 w - - 0 1",
+    "2r5/1bqnbppk/pp1ppn1p/8/2PNP3/1PN1BP2/PB3QPP/R4RK1 w - - 0 1",
+    "r1bq1rk1/pp3pbp/n2ppnp1/2p5/4PP2/2NPBN2/PPPQB1PP/R4RK1 w - - 0 1",
+    "6k1/5ppp/8/8/2B5/2P5/PP3PPP/6K1 w - - 0 1",
+    "2r5/3pk3/8/2P5/8/2K5/8/8 w - - 5 4",
+};
+
+struct BenchResult {
+    std::uint64_t nodes;
+    std::uint64_t milliseconds;
+    // Folds the node count and best move of every position in order. Single threaded searches
+    // are deterministic, so it only changes with the search itself.
+    std::uint64_t signature;
+};
+
+// Searches every position from a cleared hash table and move history, as a fresh engine would.
+// The engine's thread count and hash size are restored afterwards, but not the entries of a table
+// loaded with loadhash.
+inline BenchResult run(int depth, int threads, int hash_mb) {
+#ifdef _OPENMP
+    int previous_threads = omp_get_max_threads();
+    omp_set_num_threads(threads);
+#endif
+    int previous_hash_mb = tt.megabytes();
+    tt.resize(hash_mb);
+
+    BenchResult result{0, 0, 14695981039346656037ULL};
+    auto fold = [&result](std::uint64_t value) {
+        result.signature = (result.signature ^ value) * 1099511628211ULL;
+    };
+    auto start_time = search::curr_time();
+    for (std::size_t i = 0; i < POSITIONS.size(); ++i) {
+        std::cout << "Position " << i + 1 << "/" << POSITIONS.size() << ": " << POSITIONS[i]
+                  << "\n";
+        auto pos = *libchess::Position::from_fen(POSITIONS[i]);
+        auto search_globals = search::SearchGlobals::new_search_globals();
+        tt.clear();
+        search::clear_search_history();
+        eval::invalidate_caches();
+        auto best_move = search::best_move_search(pos, search_globals, depth);
+        result.nodes += search_globals.nodes();
+        fold(search_globals.nodes());
+        fold(best_move ? best_move->value() : 0);
+    }
+    result.milliseconds = (search::curr_time() - start_time).count();
+
+    tt.resize(previous_hash_mb);
+#ifdef _OPENMP
+    omp_set_num_threads(previous_threads);
+#endif
+    return result;
+}
+
+} // namespace bench
+
+// bench [depth] [threads] [hash MB]
+inline void bench_handler(std::istringstream& line_stream) {
+    int depth = bench::DEFAULT_DEPTH;
+    int threads = bench::DEFAULT_THREADS;
+    int hash_mb = bench::DEFAULT_HASH_MB;
+    line_stream >> depth >> threads >> hash_mb;
+    depth = std::clamp(depth, 1, search::MAX_PLY - 1);
+    threads = std::max(1, threads);
+
+    bool loaded_hash = tt.loaded();
+    auto result = bench::run(depth, threads, hash_mb);
+    std::uint64_t nps = result.milliseconds ? result.nodes * 1000 / result.milliseconds : 0;
+    std::cout << "===========================\n"
+              << "Depth           : " << depth << "\n"
+              << "Threads         : " << threads << "\n"
+              << "Hash (MB)       : " << hash_mb << "\n"
+              << "Total time (ms) : " << result.milliseconds << "\n"
+              << "Nodes searched  : " << result.nodes << "\n"
+              << "Nodes/second    : " << nps << "\n";
+    if (threads == 1) {
+        std::cout << "Signature       : " << std::hex << result.signature << std::dec << "\n";
+    }
+    if (loaded_hash) {
+        std::cout << "info string bench discarded the hash loaded with loadhash\n";
+    }
+}
+
+#endif // LIBCHESSENGINE__BENCH_H
@@ -0,0 +1,402 @@
+#ifndef LIBCHESSENGINE__DATASET_H
+#define LIBCHESSENGINE__DATASET_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libchess/Position.h"
+#include "parallel.h"
+
+namespace dataset {
+
+// A whole file mapped read-only
+class MappedFile {
+  public:
+    static std::optional<MappedFile> open(const std::string& path);
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    [[nodiscard]] const char* data() const noexcept { return static_cast<const char*>(data_); }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] std::string_view text() const noexcept { return {data(), size_}; }
+
+  private:
+    MappedFile(void* data, std::size_t size) : data_(data), size_(size) {}
+
+    void* data_;
+    std::size_t size_;
+};
+
+inline std::optional<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return {};
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return {};
+    }
+    // mmap rejects empty mappings
+    if (st.st_size == 0) {
+        close(fd);
+        return MappedFile{nullptr, 0};
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return {};
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    return MappedFile{data, std::size_t(st.st_size)};
+}
+
+struct EpdOpcode {
+    std::string_view name;
+    // Without the surrounding quotes, if it had any
+    std::string_view operand;
+};
+
+// The fields of an EPD line as views into the line: the four position fields of a FEN, then
+// opcodes such as: bm e4; id "test 1"; c9 "1-0";
+struct EpdFields {
+    [[nodiscard]] std::string fen() const {
+        std::string fen;
+        fen.reserve(board.size() + side.size() + castling.size() + en_passant.size() + 8);
+        for (auto field : {board, side, castling, en_passant}) {
+            fen.append(field).push_back(' ');
+        }
+        return fen.append("0 1");
+    }
+
+    std::string_view board;
+    std::string_view side;
+    std::string_view castling;
+    std::string_view en_passant;
+    std::vector<EpdOpcode> opcodes;
+};
+
+inline std::optional<EpdFields> parse_epd_fields(std::string_view line) {
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    std::size_t pos = 0;
+    auto skip_spaces = [&]() {
+        while (pos < line.size() && is_space(line[pos])) {
+            ++pos;
+        }
+    };
+    auto next_token = [&]() {
+        skip_spaces();
+        std::size_t begin = pos;
+        while (pos < line.size() && !is_space(line[pos]) && line[pos] != ';') {
+            ++pos;
+        }
+        return line.substr(begin, pos - begin);
+    };
+
+    EpdFields fields;
+    for (auto field : {&fields.board, &fields.side, &fields.castling, &fields.en_passant}) {
+        *field = next_token();
+        if (field->empty()) {
+            return {};
+        }
+    }
+
+    for (auto name = next_token(); !name.empty(); name = next_token()) {
+        // The operand runs to the next semicolon outside quotes
+        skip_spaces();
+        std::size_t begin = pos;
+        bool quoted = false;
+        while (pos < line.size() && (quoted || line[pos] != ';')) {
+            quoted ^= line[pos] == '"';
+            ++pos;
+        }
+        std::size_t end = pos;
+        while (end > begin && is_space(line[end - 1])) {
+            --end;
+        }
+        auto operand = line.substr(begin, end - begin);
+        if (operand.size() >= 2 && operand.front() == '"' && operand.back() == '"') {
+            operand = operand.substr(1, operand.size() - 2);
+        }
+        fields.opcodes.push_back({name, operand});
+        if (pos < line.size()) {
+            ++pos;
+        }
+    }
+    return fields;
+}
+
+// A game result as 1 for a white win, 0.5 for a draw and 0 for a black win
+inline std::optional<double> parse_result(std::string_view result) {
+    if (result == "1-0") {
+        return 1.0;
+    } else if (result == "0-1") {
+        return 0.0;
+    } else if (result == "1/2-1/2") {
+        return 0.5;
+    }
+    return {};
+}
+
+// Text is split into chunks of about this size for parsing, each ending at a line boundary
+static const std::size_t PARSE_CHUNK_BYTES = 1 << 20;
+
+// Parses every line of text on threads threads with parse(std::string_view line, Record& record),
+// which returns false for lines to skip. The lines of each chunk are counted first so that every
+// line has its slot in one preallocated buffer, which keeps the records in file order.
+template <class Record, class Parse>
+std::vector<Record> parse_lines(std::string_view text, int threads, Parse&& parse) {
+    std::vector<std::string_view> chunks;
+    for (std::size_t begin = 0; begin < text.size();) {
+        std::size_t end = text.find('\n', std::min(begin + PARSE_CHUNK_BYTES, text.size()) - 1);
+        end = end == std::string_view::npos ? text.size() : end + 1;
+        chunks.push_back(text.substr(begin, end - begin));
+        begin = end;
+    }
+
+    // first_line[c] is the index of the first line of chunk c
+    std::vector<std::size_t> first_line(chunks.size() + 1);
+    std::atomic<std::size_t> next_chunk{0};
+    parallel::run_on_threads(threads, [&]() {
+        for (std::size_t c; (c = next_chunk.fetch_add(1)) < chunks.size();) {
+            auto chunk = chunks[c];
+            first_line[c + 1] =
+                std::count(chunk.begin(), chunk.end(), '\n') + (chunk.back() != '\n');
+        }
+    });
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        first_line[c + 1] += first_line[c];
+    }
+
+    std::vector<Record> records(first_line.back());
+    std::vector<char> parsed(records.size());
+    next_chunk = 0;
+    parallel::run_on_threads(threads, [&]() {
+        for (std::size_t c; (c = next_chunk.fetch_add(1)) < chunks.size();) {
+            auto chunk = chunks[c];
+            std::size_t line = first_line[c];
+            for (std::size_t begin = 0; begin < chunk.size(); ++line) {
+                std::size_t end = std::min(chunk.find('\n', begin), chunk.size());
+                parsed[line] = parse(chunk.substr(begin, end - begin), records[line]);
+                begin = end + 1;
+            }
+        }
+    });
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (parsed[i]) {
+            records[kept++] = std::move(records[i]);
+        }
+    }
+    records.resize(kept);
+    return records;
+}
+
+// A training position in 32 bytes: the occupied squares, then one nibble per occupied square in
+// ascending square order holding its piece as color * 6 + piece type. Castling rights, en passant
+// and the move counters do not affect the static evaluation and are dropped.
+struct PackedPosition {
+    // pos must not have more than 32 pieces
+    static PackedPosition pack(const libchess::Position& pos, double result);
+
+    // Piece bitboards indexed color * 6 + piece type
+    [[nodiscard]] std::array<std::uint64_t, 12> pieces() const noexcept {
+        std::array<std::uint64_t, 12> pieces{};
+        libchess::Bitboard bb{occupancy};
+        for (int i = 0; bb; ++i) {
+            libchess::Square sq = bb.forward_bitscan();
+            bb.forward_popbit();
+            int plane = (packed_pieces[i / 2] >> (4 * (i % 2))) & 0xf;
+            pieces[plane] |= std::uint64_t(1) << sq.value();
+        }
+        return pieces;
+    }
+
+    [[nodiscard]] bool black_to_move() const noexcept { return side_to_move != 0; }
+    [[nodiscard]] double result() const noexcept { return half_points / 2.0; }
+
+    std::uint64_t occupancy;
+    std::array<std::uint8_t, 16> packed_pieces;
+    std::uint8_t side_to_move;
+    // 2 for a white win, 1 for a draw, 0 for a black win
+    std::uint8_t half_points;
+    std::uint8_t reserved[6];
+};
+
+static_assert(sizeof(PackedPosition) == 32, "packed positions must stay 32 bytes");
+
+inline PackedPosition PackedPosition::pack(const libchess::Position& pos, double result) {
+    using namespace libchess;
+    std::array<int, 64> piece_on;
+    PackedPosition packed{};
+    for (auto& color : constants::COLORS) {
+        for (auto& piece_type : constants::PIECE_TYPES) {
+            Bitboard bb = pos.piece_type_bb(piece_type, color);
+            packed.occupancy |= bb.value();
+            while (bb) {
+                piece_on[bb.forward_bitscan().value()] = color.value() * 6 + piece_type.value();
+                bb.forward_popbit();
+            }
+        }
+    }
+    Bitboard bb{packed.occupancy};
+    for (int i = 0; bb && i < 32; ++i) {
+        packed.packed_pieces[i / 2] |= piece_on[bb.forward_bitscan().value()] << (4 * (i % 2));
+        bb.forward_popbit();
+    }
+    packed.side_to_move = pos.side_to_move() == constants::BLACK;
+    packed.half_points = std::uint8_t(result * 2 + 0.5);
+    return packed;
+}
+
+// A labelled EPD line, such as: <fen> c9 "1/2-1/2"; whose result is the first opcode operand that
+// reads as a game result
+inline bool parse_labelled_line(std::string_view line, PackedPosition& packed) {
+    auto fields = parse_epd_fields(line);
+    if (!fields) {
+        return false;
+    }
+    std::optional<double> result;
+    for (auto& opcode : fields->opcodes) {
+        if ((result = parse_result(opcode.operand))) {
+            break;
+        }
+    }
+    if (!result) {
+        return false;
+    }
+    // A packed position has room for 32 pieces, so boards with more are skipped rather than
+    // truncated
+    auto pos = libchess::Position::from_fen(fields->fen());
+    if (!pos || pos->occupancy_bb().popcount() > 32) {
+        return false;
+    }
+    packed = PackedPosition::pack(*pos, *result);
+    return true;
+}
+
+// The labelled positions of an EPD file in file order, skipping lines that cannot be parsed
+inline std::optional<std::vector<PackedPosition>> read_labelled_epd(const std::string& path,
+                                                                    int threads) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return {};
+    }
+    return parse_lines<PackedPosition>(file->text(), threads, parse_labelled_line);
+}
+
+struct PackedFileHeader {
+    char magic[8];
+    std::uint64_t record_size;
+    std::uint64_t count;
+    char reserved[8];
+};
+
+inline const char PACKED_FILE_MAGIC[8] = {'L', 'C', 'E', 'P', 'K', '0', '1', '\0'};
+
+// Converts a labelled EPD file. Returns the number of positions written.
+inline std::optional<std::uint64_t> convert_epd(const std::string& epd_path,
+                                                const std::string& packed_path, int threads) {
+    auto records = read_labelled_epd(epd_path, threads);
+    std::FILE* file = records ? std::fopen(packed_path.c_str(), "wb") : nullptr;
+    if (file == nullptr) {
+        return {};
+    }
+
+    PackedFileHeader header{};
+    std::memcpy(header.magic, PACKED_FILE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(PackedPosition);
+    header.count = records->size();
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(records->data(), sizeof(PackedPosition), records->size(), file) ==
+                  records->size();
+    if (std::fclose(file) != 0 || !ok) {
+        return {};
+    }
+    return header.count;
+}
+
+// A packed file mapped read-only; iterating it reads the records in place
+class PackedFile {
+  public:
+    static std::optional<PackedFile> open(const std::string& path);
+
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+    [[nodiscard]] const PackedPosition* begin() const noexcept { return records_; }
+    [[nodiscard]] const PackedPosition* end() const noexcept { return records_ + size_; }
+    [[nodiscard]] const PackedPosition& operator[](std::size_t i) const noexcept {
+        return records_[i];
+    }
+
+  private:
+    PackedFile(MappedFile mapping, std::size_t size)
+        : mapping_(std::move(mapping)),
+          records_(reinterpret_cast<const PackedPosition*>(mapping_.data() +
+                                                           sizeof(PackedFileHeader))),
+          size_(size) {}
+
+    MappedFile mapping_;
+    const PackedPosition* records_;
+    std::size_t size_;
+};
+
+inline std::optional<PackedFile> PackedFile::open(const std::string& path) {
+    auto mapping = MappedFile::open(path);
+    PackedFileHeader header;
+    if (!mapping || mapping->size() < sizeof(header)) {
+        return {};
+    }
+    std::memcpy(&header, mapping->data(), sizeof(header));
+    bool valid = std::memcmp(header.magic, PACKED_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.record_size == sizeof(PackedPosition) &&
+                 mapping->size() == sizeof(header) + header.count * header.record_size;
+    if (!valid) {
+        return {};
+    }
+    return PackedFile{std::move(*mapping), std::size_t(header.count)};
+}
+
+} // namespace dataset
+
+// pack <epd path> <packed path> [threads]
+inline void pack_handler(std::istringstream& line_stream) {
+    std::string epd_path, packed_path;
+    line_stream >> std::quoted(epd_path) >> std::quoted(packed_path);
+    int threads = int(std::thread::hardware_concurrency());
+    line_stream >> threads;
+    if (auto count = dataset::convert_epd(epd_path, packed_path, std::max(1, threads))) {
+        std::cout << "info string packed " << *count << " positions to " << packed_path << "\n";
+    } else {
+        std::cout << "info string failed to pack " << epd_path << " to " << packed_path << "\n";
+    }
+}
+
+#endif // LIBCHESSENGINE__DATASET_H
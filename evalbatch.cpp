@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <array>
+
+#include "evalbatch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EVALBATCH_X86
+#endif
+
+using namespace libchess;
+
+namespace eval {
+
+namespace {
+
+// Positions are evaluated in chunks whose rows each span a single cache line
+constexpr std::size_t CHUNK_SIZE = 64;
+
+// The AVX2 kernel divides by MAX_PHASE with a shift
+static_assert(MAX_PHASE == 256);
+
+void evaluate_chunk_portable(const PositionBatch& batch, const BatchWeights& weights,
+                             std::size_t begin, std::size_t count, int* scores) {
+    std::array<Score, CHUNK_SIZE> chunk_scores;
+    for (std::size_t i = 0; i < count; ++i) {
+        chunk_scores[i] = batch.doubled_pawns[begin + i] * weights.doubled_pawns +
+                          batch.isolated_pawns[begin + i] * weights.isolated_pawns;
+    }
+    for (int row = 0; row < PositionBatch::ROWS; ++row) {
+        const std::uint8_t* bytes = batch.ranks.data() + row * batch.capacity + begin;
+        const Score* table = weights.row_scores.data() + (row << 8);
+        for (std::size_t i = 0; i < count; ++i) {
+            chunk_scores[i] += table[bytes[i]];
+        }
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        int eval = tapered_score(chunk_scores[i], batch.phase[begin + i]);
+        scores[begin + i] = batch.black_to_move[begin + i] ? -eval : eval;
+    }
+}
+
+#ifdef EVALBATCH_X86
+// Eight positions per vector: each row byte is widened to a table index and gathered
+__attribute__((target("avx2"))) void evaluate_chunk_avx2(const PositionBatch& batch,
+                                                         const BatchWeights& weights,
+                                                         std::size_t begin, std::size_t count,
+                                                         int* scores) {
+    std::size_t vector_count = count & ~std::size_t{7};
+    alignas(32) std::array<Score, CHUNK_SIZE> chunk_scores;
+
+    __m256i doubled_weight = _mm256_set1_epi32(weights.doubled_pawns);
+    __m256i isolated_weight = _mm256_set1_epi32(weights.isolated_pawns);
+    for (std::size_t i = 0; i < vector_count; i += 8) {
+        auto doubled = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(batch.doubled_pawns.data() + begin + i));
+        auto isolated = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(batch.isolated_pawns.data() + begin + i));
+        auto score = _mm256_add_epi32(_mm256_mullo_epi32(doubled, doubled_weight),
+                                      _mm256_mullo_epi32(isolated, isolated_weight));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(chunk_scores.data() + i), score);
+    }
+
+    for (int row = 0; row < PositionBatch::ROWS; ++row) {
+        const std::uint8_t* bytes = batch.ranks.data() + row * batch.capacity + begin;
+        const Score* table = weights.row_scores.data() + (row << 8);
+        for (std::size_t i = 0; i < vector_count; i += 8) {
+            auto index = _mm256_cvtepu8_epi32(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + i)));
+            auto row_score = _mm256_i32gather_epi32(table, index, sizeof(Score));
+            auto* score = reinterpret_cast<__m256i*>(chunk_scores.data() + i);
+            _mm256_store_si256(score, _mm256_add_epi32(_mm256_load_si256(score), row_score));
+        }
+    }
+
+    __m256i max_phase = _mm256_set1_epi32(MAX_PHASE);
+    __m256i round_eg = _mm256_set1_epi32(0x8000);
+    __m256i phase_mask = _mm256_set1_epi32(MAX_PHASE - 1);
+    for (std::size_t i = 0; i < vector_count; i += 8) {
+        auto score = _mm256_load_si256(reinterpret_cast<const __m256i*>(chunk_scores.data() + i));
+        auto phase =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(batch.phase.data() + begin + i));
+        auto black = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(batch.black_to_move.data() + begin + i));
+
+        auto mg = _mm256_srai_epi32(_mm256_slli_epi32(score, 16), 16);
+        auto eg = _mm256_srai_epi32(_mm256_add_epi32(score, round_eg), 16);
+        auto eval = _mm256_add_epi32(_mm256_mullo_epi32(mg, phase),
+                                     _mm256_mullo_epi32(eg, _mm256_sub_epi32(max_phase, phase)));
+        // Divide by MAX_PHASE rounding towards zero, as the scalar division does
+        eval = _mm256_add_epi32(eval, _mm256_and_si256(_mm256_srai_epi32(eval, 31), phase_mask));
+        eval = _mm256_srai_epi32(eval, 8);
+        // Negate where black is to move, with a mask of all ones in those lanes
+        auto negate = _mm256_sub_epi32(_mm256_setzero_si256(), black);
+        eval = _mm256_sub_epi32(_mm256_xor_si256(eval, negate), negate);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(scores + begin + i), eval);
+    }
+
+    if (vector_count < count) {
+        evaluate_chunk_portable(batch, weights, begin + vector_count, count - vector_count,
+                                scores);
+    }
+}
+#endif
+
+using ChunkKernel = void (*)(const PositionBatch&, const BatchWeights&, std::size_t, std::size_t,
+                             int*);
+
+ChunkKernel select_kernel() {
+#ifdef EVALBATCH_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return evaluate_chunk_avx2;
+    }
+#endif
+    return evaluate_chunk_portable;
+}
+
+} // namespace
+
+PositionBatch PositionBatch::new_position_batch(std::size_t capacity) {
+    return PositionBatch{0,
+                         capacity,
+                         std::vector<std::uint8_t>(ROWS * capacity),
+                         std::vector<std::int32_t>(capacity),
+                         std::vector<std::int32_t>(capacity),
+                         std::vector<std::int32_t>(capacity),
+                         std::vector<std::int32_t>(capacity)};
+}
+
+bool PositionBatch::add(const Position& pos) {
+    std::array<std::uint64_t, PLANES> pieces;
+    for (auto& color : constants::COLORS) {
+        for (auto& piece_type : constants::PIECE_TYPES) {
+            pieces[color.value() * 6 + piece_type.value()] =
+                pos.piece_type_bb(piece_type, color).value();
+        }
+    }
+    return add(pieces, pos.side_to_move() == constants::BLACK);
+}
+
+bool PositionBatch::add(const std::array<std::uint64_t, PLANES>& pieces, bool black) {
+    if (size == capacity) {
+        return false;
+    }
+
+    int position_phase = 0;
+    for (int plane = 0; plane < PLANES; ++plane) {
+        Bitboard piece_bb{pieces[plane]};
+        position_phase += piece_bb.popcount() * PIECE_PHASE[plane % 6];
+        for (int rank = 0; rank < 8; ++rank) {
+            ranks[(plane * 8 + rank) * capacity + size] = std::uint8_t(pieces[plane] >> (8 * rank));
+        }
+    }
+
+    auto pawn_counts = count_pawn_features(Bitboard{pieces[constants::PAWN.value()]},
+                                           Bitboard{pieces[6 + constants::PAWN.value()]});
+    phase[size] = position_phase;
+    doubled_pawns[size] = pawn_counts.doubled;
+    isolated_pawns[size] = pawn_counts.isolated;
+    black_to_move[size] = black;
+    ++size;
+    return true;
+}
+
+BatchWeights BatchWeights::new_batch_weights() {
+    BatchWeights weights{std::vector<Score>(PositionBatch::ROWS << 8), DOUBLED_PAWNS,
+                         ISOLATED_PAWNS, weights_generation()};
+
+    for (auto& color : constants::COLORS) {
+        int sign = color == constants::WHITE ? 1 : -1;
+        Bitboard seventh_rank = lookups::relative_rank_mask(constants::RANK_7, color);
+        for (auto& piece_type : constants::PIECE_TYPES) {
+            int plane = color.value() * 6 + piece_type.value();
+            for (int rank = 0; rank < 8; ++rank) {
+                Score* row_scores = weights.row_scores.data() + ((plane * 8 + rank) << 8);
+                for (int byte = 0; byte < 256; ++byte) {
+                    Score score = S(0, 0);
+                    for (int file = 0; file < 8; ++file) {
+                        if (!(byte & (1 << file))) {
+                            continue;
+                        }
+                        Square sq{rank * 8 + file};
+                        score += MATERIAL[piece_type] + PSQT[color][piece_type][sq];
+                        if (piece_type == constants::ROOK && (seventh_rank & Bitboard{sq})) {
+                            score += ROOK_7TH_RANK;
+                        }
+                    }
+                    row_scores[byte] = sign * score;
+                }
+            }
+        }
+    }
+    return weights;
+}
+
+void evaluate_batch(const PositionBatch& batch, const BatchWeights& weights, int* scores) {
+    evaluate_batch(batch, weights, 0, batch.size, scores);
+}
+
+void evaluate_batch(const PositionBatch& batch, const BatchWeights& weights, std::size_t begin,
+                    std::size_t end, int* scores) {
+    static const ChunkKernel kernel = select_kernel();
+    for (; begin < end; begin += CHUNK_SIZE) {
+        kernel(batch, weights, begin, std::min(CHUNK_SIZE, end - begin), scores);
+    }
+}
+
+} // namespace eval
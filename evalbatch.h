@@ -0,0 +1,63 @@
+#ifndef EVALBATCH_H
+#define EVALBATCH_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "evaluation.h"
+#include "libchess/Position.h"
+
+namespace eval {
+
+// Positions laid out structure-of-arrays for evaluate_batch. Every piece bitboard is split into
+// its eight rank bytes and each (plane, rank) row holds that byte for all positions, so a kernel
+// reads consecutive positions with a single load. The parts of the evaluation that do not depend
+// on the weights, the game phase and the pawn structure counts, are worked out once by add().
+struct PositionBatch {
+    // One plane per color and piece type, indexed color * 6 + piece type; row plane * 8 + rank
+    // starts at ranks[row * capacity]
+    static const int PLANES = 12;
+    static const int ROWS = PLANES * 8;
+
+    static PositionBatch new_position_batch(std::size_t capacity);
+
+    // Returns false when the batch is already full
+    bool add(const libchess::Position& pos);
+    // The same from the piece bitboards, indexed by plane
+    bool add(const std::array<std::uint64_t, PLANES>& pieces, bool black_to_move);
+    void clear() noexcept { size = 0; }
+
+    std::size_t size;
+    std::size_t capacity;
+    std::vector<std::uint8_t> ranks;
+    std::vector<std::int32_t> phase;
+    std::vector<std::int32_t> doubled_pawns;
+    std::vector<std::int32_t> isolated_pawns;
+    std::vector<std::int32_t> black_to_move;
+};
+
+// The evaluation weights rearranged for evaluate_batch: material, piece-square and rook on 7th
+// scores are summed per plane, rank and rank byte, which turns those terms into 96 table lookups
+// per position. A snapshot, so it must be rebuilt once the weights change.
+struct BatchWeights {
+    static BatchWeights new_batch_weights();
+
+    [[nodiscard]] bool stale() const { return generation != weights_generation(); }
+
+    std::vector<Score> row_scores;
+    Score doubled_pawns;
+    Score isolated_pawns;
+    std::uint32_t generation;
+};
+
+// Writes evaluate_uncached() of every position in the batch to scores. Uses AVX2 gathers when the
+// CPU supports them and a portable kernel otherwise.
+void evaluate_batch(const PositionBatch& batch, const BatchWeights& weights, int* scores);
+// The same for positions [begin, end) only, so that threads can share one batch
+void evaluate_batch(const PositionBatch& batch, const BatchWeights& weights, std::size_t begin,
+                    std::size_t end, int* scores);
+
+} // namespace eval
+
+#endif // EVALBATCH_H
@@ -1,88 +1,216 @@
+#include <atomic>
+
 #include "evaluation.h"
 
 using namespace libchess;
 
 namespace eval {
 
-int tapered_score(std::array<int, 2> score, int phase) {
-    return ((score[MIDGAME] * phase) + (score[ENDGAME] * (MAX_PHASE - phase))) / MAX_PHASE;
+namespace {
+
+// Pawn structure changes far less often than the rest of the position, so the pawn terms are cached
+// per thread. Entries hold both pawn bitboards, which makes a hit exact, and the cache generation
+// they were computed under, so that changing the evaluation weights invalidates them.
+struct PawnEntry {
+    std::uint64_t white_pawns;
+    std::uint64_t black_pawns;
+    Score score;
+    std::uint32_t generation;
+};
+
+constexpr std::size_t PAWN_TABLE_SIZE = 1 << 13;
+
+thread_local std::array<PawnEntry, PAWN_TABLE_SIZE> pawn_table;
+
+// Whole-position evaluations, keyed by the position hash (which includes the side to move)
+struct EvalEntry {
+    std::uint64_t key;
+    std::int32_t score;
+    std::uint32_t generation;
+};
+
+constexpr std::size_t EVAL_TABLE_SIZE = 1 << 14;
+
+thread_local std::array<EvalEntry, EVAL_TABLE_SIZE> eval_table;
+
+// Hit counters are kept per thread and folded into the shared totals every EVAL_STATS_FLUSH
+// probes, so that counting does not put a contended atomic on the evaluation path.
+constexpr std::uint64_t EVAL_STATS_FLUSH = 4096;
+
+thread_local std::uint64_t local_eval_probes = 0;
+thread_local std::uint64_t local_eval_hits = 0;
+
+std::atomic<std::uint64_t> eval_probes{0};
+std::atomic<std::uint64_t> eval_hits{0};
+
+std::atomic<std::uint32_t> cache_generation{1};
+
+inline std::size_t pawn_index(std::uint64_t white_pawns, std::uint64_t black_pawns) {
+    std::uint64_t key = (white_pawns ^ (black_pawns * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return (key ^ (key >> 31)) & (PAWN_TABLE_SIZE - 1);
 }
 
-int evaluate(const Position& pos) {
-    std::array<int, 2> score{0, 0};
+// Pawn structure score from white's point of view
+Score evaluate_pawns(const Position& pos) {
+    auto counts = count_pawn_features(pos);
+    return counts.doubled * DOUBLED_PAWNS + counts.isolated * ISOLATED_PAWNS;
+}
 
-    Bitboard pawn_bb = pos.piece_type_bb(constants::PAWN);
+Score probe_pawns(const Position& pos) {
+    std::uint64_t white_pawns = pos.piece_type_bb(constants::PAWN, constants::WHITE).value();
+    std::uint64_t black_pawns = pos.piece_type_bb(constants::PAWN, constants::BLACK).value();
+    std::uint32_t generation = cache_generation.load(std::memory_order_relaxed);
 
-    int phase = 0;
-    for (auto& color : constants::COLORS) {
-        for (auto& piece_type : constants::PIECE_TYPES) {
-            Bitboard piece_bb = pos.piece_type_bb(piece_type, color);
-            int num_piece = piece_bb.popcount();
+    PawnEntry& entry = pawn_table[pawn_index(white_pawns, black_pawns)];
+    if (entry.generation != generation || entry.white_pawns != white_pawns ||
+        entry.black_pawns != black_pawns) {
+        entry.white_pawns = white_pawns;
+        entry.black_pawns = black_pawns;
+        entry.score = evaluate_pawns(pos);
+        entry.generation = generation;
+    }
+    return entry.score;
+}
 
-            // Phase
-            phase += num_piece * PIECE_PHASE[piece_type];
+template <class Evaluate>
+int evaluate_cached(const Position& pos, Evaluate&& evaluate_position) {
+    std::uint64_t key = pos.hash();
+    std::uint32_t generation = cache_generation.load(std::memory_order_relaxed);
 
-            // Material
-            score[MIDGAME] += num_piece * MATERIAL[piece_type][MIDGAME];
-            score[ENDGAME] += num_piece * MATERIAL[piece_type][ENDGAME];
+    if (++local_eval_probes == EVAL_STATS_FLUSH) {
+        eval_probes.fetch_add(local_eval_probes, std::memory_order_relaxed);
+        eval_hits.fetch_add(local_eval_hits, std::memory_order_relaxed);
+        local_eval_probes = local_eval_hits = 0;
+    }
 
-            // Piece Square Tables
-            Bitboard bb = piece_bb;
-            while (bb) {
-                Square sq = bb.forward_bitscan();
-                bb.forward_popbit();
-                score[MIDGAME] += PSQT[color][piece_type][sq][MIDGAME];
-                score[ENDGAME] += PSQT[color][piece_type][sq][ENDGAME];
+    EvalEntry& entry = eval_table[key & (EVAL_TABLE_SIZE - 1)];
+    if (entry.key == key && entry.generation == generation) {
+        ++local_eval_hits;
+        return entry.score;
+    }
+
+    int score = evaluate_position();
+    entry.key = key;
+    entry.score = score;
+    entry.generation = generation;
+    return score;
+}
+
+} // namespace
+
+PawnFeatureCounts count_pawn_features(Bitboard white_pawns, Bitboard black_pawns) {
+    PawnFeatureCounts counts{0, 0};
+    for (auto& color : constants::COLORS) {
+        Bitboard own_pawns = color == constants::WHITE ? white_pawns : black_pawns;
+        int sign = color == constants::WHITE ? 1 : -1;
+
+        Bitboard bb = own_pawns;
+        while (bb) {
+            Square sq = bb.forward_bitscan();
+            bb.forward_popbit();
+
+            if (lookups::north(sq) & own_pawns) {
+                counts.doubled += sign;
             }
 
-            // Pawn eval
-            if (piece_type == constants::PAWN) {
-                bb = piece_bb;
-                while (bb) {
-                    Square sq = bb.forward_bitscan();
-                    bb.forward_popbit();
-
-                    if (lookups::north(sq) & (pawn_bb & pos.color_bb(color))) {
-                        score[MIDGAME] += DOUBLED_PAWNS_MG;
-                        score[ENDGAME] += DOUBLED_PAWNS_EG;
-                    }
-
-                    Bitboard isolated_pawn_mask = [&]() {
-                        Bitboard bb;
-                        File sq_file = sq.file();
-                        if (sq_file != constants::FILE_H) {
-                            bb |= lookups::file_mask(File{sq_file + 1});
-                        }
-                        if (sq_file != constants::FILE_A) {
-                            bb |= lookups::file_mask(File{sq_file - 1});
-                        }
-                        return bb;
-                    }();
-                    if (!(isolated_pawn_mask & (pawn_bb & pos.color_bb(color)))) {
-                        score[MIDGAME] += ISOLATED_PAWNS_MG;
-                        score[ENDGAME] += ISOLATED_PAWNS_EG;
-                    }
+            Bitboard isolated_pawn_mask = [&]() {
+                Bitboard bb;
+                File sq_file = sq.file();
+                if (sq_file != constants::FILE_H) {
+                    bb |= lookups::file_mask(File{sq_file + 1});
                 }
+                if (sq_file != constants::FILE_A) {
+                    bb |= lookups::file_mask(File{sq_file - 1});
+                }
+                return bb;
+            }();
+            if (!(isolated_pawn_mask & own_pawns)) {
+                counts.isolated += sign;
             }
+        }
+    }
+    return counts;
+}
+
+PawnFeatureCounts count_pawn_features(const Position& pos) {
+    return count_pawn_features(pos.piece_type_bb(constants::PAWN, constants::WHITE),
+                               pos.piece_type_bb(constants::PAWN, constants::BLACK));
+}
+
+void invalidate_caches() { cache_generation.fetch_add(1, std::memory_order_relaxed); }
+
+std::uint32_t weights_generation() { return cache_generation.load(std::memory_order_relaxed); }
+
+int tapered_score(Score score, int phase) {
+    return ((mg_value(score) * phase) + (eg_value(score) * (MAX_PHASE - phase))) / MAX_PHASE;
+}
 
-            // Rook eval
-            if (piece_type == constants::ROOK) {
-                // Rook on 7th rank
-                Bitboard rook_7th_rank_bb =
-                    (piece_bb & lookups::relative_rank_mask(constants::RANK_7, color));
-                score[MIDGAME] += rook_7th_rank_bb.popcount() * ROOK_7TH_RANK_MG;
-                score[ENDGAME] += rook_7th_rank_bb.popcount() * ROOK_7TH_RANK_EG;
+Accumulator Accumulator::new_accumulator(const Position& pos, nnue::Accumulator* network) {
+    Accumulator accumulator{S(0, 0), 0, pos.hash(), nnue::active() ? network : nullptr};
+    for (auto& color : constants::COLORS) {
+        for (auto& piece_type : constants::PIECE_TYPES) {
+            Bitboard bb = pos.piece_type_bb(piece_type, color);
+            while (bb) {
+                Square sq = bb.forward_bitscan();
+                bb.forward_popbit();
+                accumulator.add_piece(color, piece_type, sq);
             }
         }
-        score[MIDGAME] = -score[MIDGAME];
-        score[ENDGAME] = -score[ENDGAME];
     }
+    if (accumulator.network) {
+        nnue::refresh(pos, *accumulator.network);
+    }
+    return accumulator;
+}
+
+int evaluate_uncached(const Position& pos, const Accumulator& accumulator) {
+    Score score = accumulator.score;
+
+    // Rook on 7th rank
+    for (auto& color : constants::COLORS) {
+        int sign = color == constants::WHITE ? 1 : -1;
+        Bitboard rook_7th_rank_bb = pos.piece_type_bb(constants::ROOK, color) &
+                                    lookups::relative_rank_mask(constants::RANK_7, color);
+        score += sign * rook_7th_rank_bb.popcount() * ROOK_7TH_RANK;
+    }
+
+    // Pawn structure
+    score += probe_pawns(pos);
 
-    int eval = tapered_score(score, phase);
+    int eval = tapered_score(score, accumulator.phase);
     if (pos.side_to_move() == constants::BLACK) {
         eval = -eval;
     }
     return eval;
 }
 
+int evaluate_uncached(const Position& pos) {
+    return evaluate_uncached(pos, Accumulator::new_accumulator(pos));
+}
+
+int evaluate(const Position& pos) {
+    return evaluate_cached(pos, [&]() {
+        return nnue::active() ? nnue::evaluate(pos) : evaluate_uncached(pos);
+    });
+}
+
+int evaluate(const Position& pos, const Accumulator& accumulator) {
+    return evaluate_cached(pos, [&]() {
+        if (!nnue::active()) {
+            return evaluate_uncached(pos, accumulator);
+        }
+        return accumulator.network ? nnue::evaluate(pos, *accumulator.network)
+                                   : nnue::evaluate(pos);
+    });
+}
+
+EvalCacheStats eval_cache_stats() {
+    return {eval_probes.load(std::memory_order_relaxed), eval_hits.load(std::memory_order_relaxed)};
+}
+
+void reset_eval_cache_stats() {
+    eval_probes.store(0, std::memory_order_relaxed);
+    eval_hits.store(0, std::memory_order_relaxed);
+}
+
 } // namespace eval
@@ -2,104 +2,123 @@
 #define EVALUATION_H
 
 #include "libchess/Position.h"
+#include "nnue.h"
 
 #include <array>
+#include <cstdint>
 
 namespace eval {
 
 enum Stage : int { MIDGAME, ENDGAME };
 
+// A midgame and an endgame value packed into one integer, the endgame half in the upper 16 bits.
+// Adding or scaling packed scores does the same to both halves with a single integer operation;
+// they are only split again when the evaluation is tapered by game phase.
+using Score = std::int32_t;
+
+constexpr Score S(int mg, int eg) { return Score(std::uint32_t(eg) << 16) + mg; }
+
+constexpr int mg_value(Score score) { return std::int16_t(std::uint16_t(std::uint32_t(score))); }
+
+// The low half borrows from the high half when it is negative, which the rounding undoes
+constexpr int eg_value(Score score) {
+    return std::int16_t(std::uint16_t((std::uint32_t(score) + 0x8000) >> 16));
+}
+
+// Replace one half of a packed score and keep the other, as the tuner does one weight at a time
+inline void set_mg_value(Score& score, int mg) { score = S(mg, eg_value(score)); }
+inline void set_eg_value(Score& score, int eg) { score = S(mg_value(score), eg); }
+
 inline const int MAX_PHASE = 256;
 
 inline const std::array<int, 6> PIECE_PHASE{{1, 10, 10, 20, 40, 0}};
 
-inline std::array<std::array<int, 2>, 6> MATERIAL{{
-    {147, 116},
-    {378, 518},
-    {414, 547},
-    {741, 658},
-    {1335, 1474},
-    {0, 0},
+inline std::array<Score, 6> MATERIAL{{
+    S(147, 116),
+    S(378, 518),
+    S(414, 547),
+    S(741, 658),
+    S(1335, 1474),
+    S(0, 0),
 }};
 
-inline int ROOK_7TH_RANK_MG = 101;
-inline int ROOK_7TH_RANK_EG = -3;
+inline Score ROOK_7TH_RANK = S(101, -3);
 
-inline int DOUBLED_PAWNS_MG = -13;
-inline int DOUBLED_PAWNS_EG = -43;
+inline Score DOUBLED_PAWNS = S(-13, -43);
 
-inline int ISOLATED_PAWNS_MG = -31;
-inline int ISOLATED_PAWNS_EG = -5;
+inline Score ISOLATED_PAWNS = S(-31, -5);
 
 // clang-format off
-inline std::array<std::array<std::array<int, 2>, 32>, 6> PSQT_TMP = {
+inline std::array<std::array<Score, 32>, 6> PSQT_TMP = {
     {{{	// Pawn
-          {  0,   0}, {  0,   0}, {  0,   0}, {  0,   0},
-          {  0,   0}, {  0,   0}, {  0,   0}, {  0,   0},
-          {  0,   5}, {  0,   5}, {  0,   5}, { 10,   5},
-          {  0,  10}, {  0,  10}, {  0,  10}, { 20,  10},
-          {  0,  30}, {  0,  30}, {  0,  30}, { 15,  30},
-          {  0,  50}, {  0,  50}, {  0,  50}, {  0,  50},
-          {  0,  80}, {  0,  80}, {  0,  80}, {  0,  80},
-          {  0,   0}, {  0,   0}, {  0,   0}, {  0,   0}
+          S(  0,   0), S(  0,   0), S(  0,   0), S(  0,   0),
+          S(  0,   0), S(  0,   0), S(  0,   0), S(  0,   0),
+          S(  0,   5), S(  0,   5), S(  0,   5), S( 10,   5),
+          S(  0,  10), S(  0,  10), S(  0,  10), S( 20,  10),
+          S(  0,  30), S(  0,  30), S(  0,  30), S( 15,  30),
+          S(  0,  50), S(  0,  50), S(  0,  50), S(  0,  50),
+          S(  0,  80), S(  0,  80), S(  0,  80), S(  0,  80),
+          S(  0,   0), S(  0,   0), S(  0,   0), S(  0,   0)
       }},
      {{	// Knight
-          {-50, -30}, {-30, -20}, {-20, -10}, {-15,   0},
-          {-30, -20}, { -5, -10}, {  0,  -5}, {  5,   5},
-          {-10, -10}, {  0,  -5}, {  5,   5}, { 10,  10},
-          {-10,   0}, {  5,   0}, { 10,  15}, { 20,  20},
-          {-10,   0}, {  5,   0}, { 10,  15}, { 20,  20},
-          {-10, -10}, {  0,  -5}, {  5,   5}, { 10,  10},
-          {-30, -20}, { -5, -10}, {  0,  -5}, {  5,   5},
-          {-50, -30}, {-30, -20}, {-20, -10}, {-15,   0}
+          S(-50, -30), S(-30, -20), S(-20, -10), S(-15,   0),
+          S(-30, -20), S( -5, -10), S(  0,  -5), S(  5,   5),
+          S(-10, -10), S(  0,  -5), S(  5,   5), S( 10,  10),
+          S(-10,   0), S(  5,   0), S( 10,  15), S( 20,  20),
+          S(-10,   0), S(  5,   0), S( 10,  15), S( 20,  20),
+          S(-10, -10), S(  0,  -5), S(  5,   5), S( 10,  10),
+          S(-30, -20), S( -5, -10), S(  0,  -5), S(  5,   5),
+          S(-50, -30), S(-30, -20), S(-20, -10), S(-15,   0)
       }},
      {{	// Bishop
-          {-20, -20}, {-20, -15}, {-20, -10}, {-20, -10},
-          {-10,   0}, {  0,   0}, { -5,   0}, {  0,   0},
-          { -5,   0}, {  5,   0}, {  5,   0}, {  5,   0},
-          {  0,   0}, {  5,   0}, { 10,   0}, { 15,   0},
-          {  0,   0}, {  5,   0}, { 10,   0}, { 15,   0},
-          { -5,   0}, {  5,   0}, {  5,   0}, {  5,   0},
-          {-10,   0}, {  0,   0}, { -5,   0}, {  0,   0},
-          {-20, -20}, {-20, -15}, {-20, -10}, {-20, -10}
+          S(-20, -20), S(-20, -15), S(-20, -10), S(-20, -10),
+          S(-10,   0), S(  0,   0), S( -5,   0), S(  0,   0),
+          S( -5,   0), S(  5,   0), S(  5,   0), S(  5,   0),
+          S(  0,   0), S(  5,   0), S( 10,   0), S( 15,   0),
+          S(  0,   0), S(  5,   0), S( 10,   0), S( 15,   0),
+          S( -5,   0), S(  5,   0), S(  5,   0), S(  5,   0),
+          S(-10,   0), S(  0,   0), S( -5,   0), S(  0,   0),
+          S(-20, -20), S(-20, -15), S(-20, -10), S(-20, -10)
       }},
      {{	// Rook
-          { -5,  -5}, {  0,  -3}, {  2,  -1}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,   0}, {  0,   0}, {  2,   0}, {  5,   0},
-          { -5,  -5}, {  0,  -3}, {  2,  -1}, {  5,   0}
+          S( -5,  -5), S(  0,  -3), S(  2,  -1), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,   0), S(  0,   0), S(  2,   0), S(  5,   0),
+          S( -5,  -5), S(  0,  -3), S(  2,  -1), S(  5,   0)
       }},
      {{
           // Queen
-          {-10, -20}, { -5, -10}, { -5,  -5}, { -5,   0},
-          { -5, -10}, {  0,  -5}, {  0,   0}, {  0,   5},
-          { -5,  -5}, {  0,   5}, {  0,   5}, {  0,  10},
-          { -5,   0}, {  0,   5}, {  0,  10}, {  0,  15},
-          { -5,   0}, {  0,   5}, {  0,  10}, {  0,  15},
-          { -5,  -5}, {  0,   5}, {  0,   5}, {  0,  10},
-          { -5, -10}, {  0,  -5}, {  0,   0}, {  0,   5},
-          {-10, -20}, { -5, -10}, { -5,  -5}, { -5,   0}
+          S(-10, -20), S( -5, -10), S( -5,  -5), S( -5,   0),
+          S( -5, -10), S(  0,  -5), S(  0,   0), S(  0,   5),
+          S( -5,  -5), S(  0,   5), S(  0,   5), S(  0,  10),
+          S( -5,   0), S(  0,   5), S(  0,  10), S(  0,  15),
+          S( -5,   0), S(  0,   5), S(  0,  10), S(  0,  15),
+          S( -5,  -5), S(  0,   5), S(  0,   5), S(  0,  10),
+          S( -5, -10), S(  0,  -5), S(  0,   0), S(  0,   5),
+          S(-10, -20), S( -5, -10), S( -5,  -5), S( -5,   0)
       }},
      {{
           // King
-          { 30, -70}, { 45, -45}, { 10, -35}, {-10, -20},
-          { 10, -40}, { 20, -25}, {  0, -10}, {-15,   5},
-          {-20, -30}, {-25, -15}, {-30,   5}, {-30,  10},
-          {-40, -20}, {-50,   5}, {-60,  10}, {-70,  20},
-          {-70, -20}, {-80,   5}, {-90,  10}, {-90,  20},
-          {-70, -30}, {-80, -15}, {-90,   5}, {-90,  10},
-          {-80, -40}, {-80, -25}, {-90, -10}, {-90,   0},
-          {-90, -70}, {-90, -45}, {-90, -15}, {-90, -20}
+          S( 30, -70), S( 45, -45), S( 10, -35), S(-10, -20),
+          S( 10, -40), S( 20, -25), S(  0, -10), S(-15,   5),
+          S(-20, -30), S(-25, -15), S(-30,   5), S(-30,  10),
+          S(-40, -20), S(-50,   5), S(-60,  10), S(-70,  20),
+          S(-70, -20), S(-80,   5), S(-90,  10), S(-90,  20),
+          S(-70, -30), S(-80, -15), S(-90,   5), S(-90,  10),
+          S(-80, -40), S(-80, -25), S(-90, -10), S(-90,   0),
+          S(-90, -70), S(-90, -45), S(-90, -15), S(-90, -20)
       }}
     }};
 // clang-format on
 
-inline const std::array<std::array<std::array<std::array<int, 2>, 64>, 6>, 2> PSQT = []() {
-    std::array<std::array<std::array<std::array<int, 2>, 64>, 6>, 2> psqt{};
+// Expands PSQT_TMP, which covers the queen side from white's point of view, to every square of
+// both colors
+inline std::array<std::array<std::array<Score, 64>, 6>, 2> build_psqt() {
+    std::array<std::array<std::array<Score, 64>, 6>, 2> psqt{};
     for (int c = 0; c < 2; ++c) {
         int k = 0;
         for (int rank = 0; rank < 8; ++rank) {
@@ -112,16 +131,122 @@ inline const std::array<std::array<std::array<std::array<int, 2>, 64>, 6>, 2> PS
                 }
                 for (int pt = 0; pt < 6; ++pt) {
                     psqt[c][pt][sq1] = psqt[c][pt][sq2] = PSQT_TMP[pt][k];
-                    psqt[c][pt][sq1] = psqt[c][pt][sq2] = PSQT_TMP[pt][k];
                 }
                 ++k;
             }
         }
     }
     return psqt;
-}();
+}
+
+// Rebuilt with build_psqt() whenever PSQT_TMP changes
+inline std::array<std::array<std::array<Score, 64>, 6>, 2> PSQT = build_psqt();
+
+// Material, piece-square and phase sums of a position, from white's point of view, and with a
+// network loaded its feature transformer output. The search keeps one per ply and derives a
+// child's from its parent's by the handful of squares a move touches, so only the pawn and rook
+// terms or the network layers are left to compute per evaluation. key is the hash of the
+// position the sums belong to.
+struct Accumulator {
+    // network, if given, receives the network accumulator while a network is loaded
+    static Accumulator new_accumulator(const libchess::Position& pos,
+                                       nnue::Accumulator* network = nullptr);
+
+    void add_piece(libchess::Color color, libchess::PieceType pt, libchess::Square sq) noexcept {
+        int sign = color == libchess::constants::WHITE ? 1 : -1;
+        score += sign * (MATERIAL[pt] + PSQT[color][pt][sq]);
+        phase += PIECE_PHASE[pt];
+    }
+
+    void remove_piece(libchess::Color color, libchess::PieceType pt, libchess::Square sq) noexcept {
+        int sign = color == libchess::constants::WHITE ? 1 : -1;
+        score -= sign * (MATERIAL[pt] + PSQT[color][pt][sq]);
+        phase -= PIECE_PHASE[pt];
+    }
+
+    // Castling moves two pieces and is rare, and a king move changes every network feature of its
+    // side, so after these the caller recomputes the accumulator from scratch instead
+    [[nodiscard]] static bool needs_refresh(const libchess::Position& pos, libchess::Move move) {
+        using namespace libchess;
+        return move.type() == Move::Type::CASTLING ||
+               (nnue::active() && pos.piece_type_on(move.from_square()) == constants::KING);
+    }
+
+    // Writes the sums after move is made in pos, which must be the position before the move, to
+    // child. The network part is only maintained while a network is loaded, into the buffer
+    // child.network points at; without one the child evaluates the network from scratch.
+    void after_move(const libchess::Position& pos, libchess::Move move, Accumulator& child) const {
+        using namespace libchess;
+        child.score = score;
+        child.phase = phase;
+        nnue::DirtyPieces dirty;
+        Color stm = pos.side_to_move();
+        Square from = move.from_square();
+        Square to = move.to_square();
+        PieceType pt = *pos.piece_type_on(from);
+        PieceType placed = move.promotion_piece_type().value_or(pt);
+
+        if (move.type() == Move::Type::ENPASSANT) {
+            Square captured_sq{to.value() + (stm == constants::WHITE ? -8 : 8)};
+            child.remove_piece(!stm, constants::PAWN, captured_sq);
+            dirty.remove(!stm, constants::PAWN, captured_sq);
+        } else if (auto captured = pos.piece_type_on(to)) {
+            child.remove_piece(!stm, *captured, to);
+            dirty.remove(!stm, *captured, to);
+        }
+        child.remove_piece(stm, pt, from);
+        child.add_piece(stm, placed, to);
+        if (nnue::active() && network && child.network) {
+            dirty.remove(stm, pt, from);
+            dirty.add(stm, placed, to);
+            nnue::update(pos, dirty, *network, *child.network);
+        } else {
+            child.network = nullptr;
+        }
+    }
+
+    Score score;
+    int phase;
+    std::uint64_t key;
+    // Null unless a network is loaded; points into a per-thread buffer rather than holding the
+    // 1 KB network accumulator in every search stack frame
+    nnue::Accumulator* network;
+};
 
+// Evaluation from the side to move's point of view, served from a per-thread cache when possible.
+// evaluate() uses the network while one is loaded; evaluate_uncached() is always handcrafted.
 int evaluate(const libchess::Position&);
+int evaluate(const libchess::Position&, const Accumulator&);
+int evaluate_uncached(const libchess::Position&);
+int evaluate_uncached(const libchess::Position&, const Accumulator&);
+
+struct EvalCacheStats {
+    std::uint64_t probes;
+    std::uint64_t hits;
+};
+
+// Totals over all threads; each thread reports its counts in batches, so recent probes may lag
+EvalCacheStats eval_cache_stats();
+void reset_eval_cache_stats();
+
+// Doubled and isolated pawns, white's count minus black's. They only depend on the pawns, so
+// callers evaluating the same position under many weight sets can count them once.
+struct PawnFeatureCounts {
+    int doubled;
+    int isolated;
+};
+
+PawnFeatureCounts count_pawn_features(const libchess::Position&);
+PawnFeatureCounts count_pawn_features(libchess::Bitboard white_pawns,
+                                      libchess::Bitboard black_pawns);
+
+// Interpolates between the midgame and endgame halves of a score by game phase
+int tapered_score(Score score, int phase);
+
+// Must be called after changing any evaluation weight so that cached terms are recomputed
+void invalidate_caches();
+// Bumped by every invalidate_caches(), so tables derived from the weights can tell they are stale
+std::uint32_t weights_generation();
 
 } // namespace eval
 
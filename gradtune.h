@@ -0,0 +1,289 @@
+#ifndef LIBCHESSENGINE__GRADTUNE_H
+#define LIBCHESSENGINE__GRADTUNE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "evaluation.h"
+#include "tune.h"
+
+namespace tune {
+
+// With the game phase fixed the handcrafted evaluation is linear in its weights: from white's
+// point of view it is (phase * mg + (MAX_PHASE - phase) * eg) / MAX_PHASE, where mg and eg sum
+// each feature's coefficient times the matching half of its weight. These are the features in the
+// order their weights are kept in.
+static const int MATERIAL_FEATURES = 0;
+static const int PSQT_FEATURES = MATERIAL_FEATURES + 5;
+static const int ROOK_7TH_RANK_FEATURE = PSQT_FEATURES + 6 * 32;
+static const int DOUBLED_PAWNS_FEATURE = ROOK_7TH_RANK_FEATURE + 1;
+static const int ISOLATED_PAWNS_FEATURE = DOUBLED_PAWNS_FEATURE + 1;
+static const int NUM_FEATURES = ISOLATED_PAWNS_FEATURE + 1;
+
+inline std::array<eval::Score*, NUM_FEATURES> feature_weights() {
+    std::array<eval::Score*, NUM_FEATURES> weights;
+    for (int pt = 0; pt < 5; ++pt) {
+        weights[MATERIAL_FEATURES + pt] = &eval::MATERIAL[pt];
+    }
+    for (int pt = 0; pt < 6; ++pt) {
+        for (int k = 0; k < 32; ++k) {
+            weights[PSQT_FEATURES + pt * 32 + k] = &eval::PSQT_TMP[pt][k];
+        }
+    }
+    weights[ROOK_7TH_RANK_FEATURE] = &eval::ROOK_7TH_RANK;
+    weights[DOUBLED_PAWNS_FEATURE] = &eval::DOUBLED_PAWNS;
+    weights[ISOLATED_PAWNS_FEATURE] = &eval::ISOLATED_PAWNS;
+    return weights;
+}
+
+// The PSQT_TMP entry a square reads, as eval::build_psqt() lays them out
+inline int psqt_index(int color, int sq) {
+    if (color == 1) {
+        sq ^= 56;
+    }
+    int file = sq & 7;
+    return (sq >> 3) * 4 + std::min(file, 7 - file);
+}
+
+// The non-zero feature coefficients of every position, stored back to back: those of position i
+// are at [offsets[i], offsets[i + 1]). A position has around 40, out of NUM_FEATURES.
+struct LinearFeatures {
+    static LinearFeatures from_tuning_data(const TuningData& data);
+
+    [[nodiscard]] std::size_t size() const noexcept { return results.size(); }
+
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint16_t> features;
+    std::vector<std::int8_t> coefficients;
+    // Game phase as a fraction of MAX_PHASE
+    std::vector<float> phase;
+    std::vector<float> results;
+};
+
+// Reads the coefficients back out of the batch layout, which already holds every piece and the
+// pawn structure counts
+inline LinearFeatures LinearFeatures::from_tuning_data(const TuningData& data) {
+    using namespace libchess;
+    const auto& positions = data.positions;
+    LinearFeatures linear;
+    linear.offsets.reserve(positions.size + 1);
+    linear.offsets.push_back(0);
+
+    std::array<int, NUM_FEATURES> dense;
+    for (std::size_t i = 0; i < positions.size; ++i) {
+        dense.fill(0);
+        for (int color = 0; color < 2; ++color) {
+            int sign = color == 0 ? 1 : -1;
+            int seventh_rank = color == 0 ? 6 : 1;
+            for (int pt = 0; pt < 6; ++pt) {
+                int plane = color * 6 + pt;
+                for (int rank = 0; rank < 8; ++rank) {
+                    int bits = positions.ranks[(plane * 8 + rank) * positions.capacity + i];
+                    for (int file = 0; file < 8; ++file) {
+                        if (!(bits & (1 << file))) {
+                            continue;
+                        }
+                        if (pt != constants::KING.value()) {
+                            dense[MATERIAL_FEATURES + pt] += sign;
+                        }
+                        dense[PSQT_FEATURES + pt * 32 + psqt_index(color, rank * 8 + file)] += sign;
+                        if (pt == constants::ROOK.value() && rank == seventh_rank) {
+                            dense[ROOK_7TH_RANK_FEATURE] += sign;
+                        }
+                    }
+                }
+            }
+        }
+        dense[DOUBLED_PAWNS_FEATURE] = positions.doubled_pawns[i];
+        dense[ISOLATED_PAWNS_FEATURE] = positions.isolated_pawns[i];
+
+        for (int feature = 0; feature < NUM_FEATURES; ++feature) {
+            if (dense[feature]) {
+                linear.features.push_back(std::uint16_t(feature));
+                linear.coefficients.push_back(std::int8_t(dense[feature]));
+            }
+        }
+        linear.offsets.push_back(std::uint32_t(linear.features.size()));
+        linear.phase.push_back(float(positions.phase[i]) / eval::MAX_PHASE);
+        linear.results.push_back(float(data.results[i]));
+    }
+    return linear;
+}
+
+// Full-batch Adam over the midgame and endgame half of every feature weight. Each epoch is one
+// sparse sweep over the features; threads take fixed blocks and the block gradients are added in
+// order, so the run is deterministic whatever the thread count.
+class GradientTuner {
+  public:
+    static const int NUM_WEIGHTS = 2 * NUM_FEATURES;
+
+    GradientTuner(const LinearFeatures& linear, int threads, double learning_rate)
+        : linear_(linear), threads_(std::max(1, threads)), learning_rate_(learning_rate) {
+        auto weights = feature_weights();
+        for (int feature = 0; feature < NUM_FEATURES; ++feature) {
+            weights_[2 * feature] = eval::mg_value(*weights[feature]);
+            weights_[2 * feature + 1] = eval::eg_value(*weights[feature]);
+        }
+    }
+
+    // One Adam step; returns the mean squared error of the weights before it
+    double epoch() {
+        std::size_t size = linear_.size();
+        std::size_t num_blocks = (size + ERROR_BLOCK_SIZE - 1) / ERROR_BLOCK_SIZE;
+        std::vector<std::array<double, NUM_WEIGHTS>> block_gradients(num_blocks);
+        std::vector<double> block_errors(num_blocks);
+        std::atomic<std::size_t> next_block{0};
+
+        // d sigmoid(e) / d e = sigmoid(e) * (1 - sigmoid(e)) * SIGMOID_SLOPE
+        const double SIGMOID_SLOPE = SIGMOID_K * std::log(10.0) / 400.0;
+        auto worker = [&]() {
+            for (std::size_t block; (block = next_block.fetch_add(1)) < num_blocks;) {
+                auto& gradient = block_gradients[block];
+                gradient.fill(0.0);
+                double error = 0.0;
+                std::size_t end = std::min((block + 1) * ERROR_BLOCK_SIZE, size);
+                for (std::size_t i = block * ERROR_BLOCK_SIZE; i < end; ++i) {
+                    double mg = 0.0;
+                    double eg = 0.0;
+                    for (auto j = linear_.offsets[i]; j < linear_.offsets[i + 1]; ++j) {
+                        int weight = 2 * linear_.features[j];
+                        mg += linear_.coefficients[j] * weights_[weight];
+                        eg += linear_.coefficients[j] * weights_[weight + 1];
+                    }
+                    double phase = linear_.phase[i];
+                    double eval = phase * mg + (1.0 - phase) * eg;
+                    double prediction = 1.0 / (1.0 + std::pow(10.0, -SIGMOID_K * eval / 400.0));
+                    double diff = linear_.results[i] - prediction;
+                    error += diff * diff;
+
+                    double d_eval = -2.0 * diff * prediction * (1.0 - prediction) * SIGMOID_SLOPE;
+                    for (auto j = linear_.offsets[i]; j < linear_.offsets[i + 1]; ++j) {
+                        int weight = 2 * linear_.features[j];
+                        double d_weight = d_eval * linear_.coefficients[j];
+                        gradient[weight] += d_weight * phase;
+                        gradient[weight + 1] += d_weight * (1.0 - phase);
+                    }
+                }
+                block_errors[block] = error;
+            }
+        };
+        parallel::run_on_threads(threads_, worker);
+
+        std::array<double, NUM_WEIGHTS> gradient{};
+        double error = 0.0;
+        for (std::size_t block = 0; block < num_blocks; ++block) {
+            for (int w = 0; w < NUM_WEIGHTS; ++w) {
+                gradient[w] += block_gradients[block][w];
+            }
+            error += block_errors[block];
+        }
+
+        ++step_;
+        double bias1 = 1.0 - std::pow(BETA1, step_);
+        double bias2 = 1.0 - std::pow(BETA2, step_);
+        for (int w = 0; w < NUM_WEIGHTS; ++w) {
+            double g = size ? gradient[w] / size : 0.0;
+            momentum_[w] = BETA1 * momentum_[w] + (1.0 - BETA1) * g;
+            velocity_[w] = BETA2 * velocity_[w] + (1.0 - BETA2) * g * g;
+            weights_[w] -= learning_rate_ * (momentum_[w] / bias1) /
+                           (std::sqrt(velocity_[w] / bias2) + EPSILON);
+        }
+        return size ? error / size : 0.0;
+    }
+
+    // Rounds the weights into the evaluation
+    void apply() const {
+        auto weights = feature_weights();
+        for (int feature = 0; feature < NUM_FEATURES; ++feature) {
+            *weights[feature] = eval::S(int(std::lround(weights_[2 * feature])),
+                                        int(std::lround(weights_[2 * feature + 1])));
+        }
+        eval::PSQT = eval::build_psqt();
+        eval::invalidate_caches();
+    }
+
+  private:
+    static constexpr double BETA1 = 0.9;
+    static constexpr double BETA2 = 0.999;
+    static constexpr double EPSILON = 1e-8;
+
+    const LinearFeatures& linear_;
+    int threads_;
+    double learning_rate_;
+    int step_ = 0;
+    std::array<double, NUM_WEIGHTS> weights_{};
+    std::array<double, NUM_WEIGHTS> momentum_{};
+    std::array<double, NUM_WEIGHTS> velocity_{};
+};
+
+// Prints the weights in the layout of evaluation.h
+inline void display_feature_weights() {
+    auto print = [](eval::Score score) {
+        std::cout << "S(" << std::setw(4) << eval::mg_value(score) << ", " << std::setw(4)
+                  << eval::eg_value(score) << ")";
+    };
+    std::cout << "MATERIAL\n";
+    for (int pt = 0; pt < 5; ++pt) {
+        print(eval::MATERIAL[pt]);
+        std::cout << ",\n";
+    }
+    std::cout << "ROOK_7TH_RANK ";
+    print(eval::ROOK_7TH_RANK);
+    std::cout << "\nDOUBLED_PAWNS ";
+    print(eval::DOUBLED_PAWNS);
+    std::cout << "\nISOLATED_PAWNS ";
+    print(eval::ISOLATED_PAWNS);
+    std::cout << "\nPSQT_TMP\n";
+    for (int pt = 0; pt < 6; ++pt) {
+        for (int k = 0; k < 32; ++k) {
+            print(eval::PSQT_TMP[pt][k]);
+            std::cout << (k % 4 == 3 ? ",\n" : ", ");
+        }
+        std::cout << "\n";
+    }
+}
+
+} // namespace tune
+
+// gradtune <epd or packed path> [epochs] [threads] [learning rate]
+inline void gradtune_handler(std::istringstream& line_stream) {
+    std::string path;
+    line_stream >> std::quoted(path);
+    int epochs = 1000;
+    int threads = int(std::thread::hardware_concurrency());
+    double learning_rate = 1.0;
+    line_stream >> epochs >> threads >> learning_rate;
+    threads = std::max(1, threads);
+
+    auto data = tune::TuningData::from_file(path, threads);
+    if (!data) {
+        std::cout << "info string failed to read " << path << "\n";
+        return;
+    }
+    auto linear = tune::LinearFeatures::from_tuning_data(*data);
+    std::cout << "tuning " << tune::NUM_FEATURES << " features over " << linear.size()
+              << " positions (" << linear.features.size() << " coefficients) on " << threads
+              << " threads...\n";
+
+    tune::GradientTuner tuner{linear, threads, learning_rate};
+    for (int epoch = 1; epoch <= epochs; ++epoch) {
+        double error = tuner.epoch();
+        if (epoch == 1 || epoch % 50 == 0 || epoch == epochs) {
+            std::cout << "Epoch " << epoch << " error: " << error << "\n";
+        }
+    }
+    tuner.apply();
+    tune::display_feature_weights();
+    std::cout << "Done!\n";
+}
+
+#endif // LIBCHESSENGINE__GRADTUNE_H
@@ -1,3 +1,4 @@
+#include <iomanip>
 #include <iostream>
 
 #ifdef USE_MPI_SEARCH
@@ -8,9 +9,20 @@
 #include "libchess/Position.h"
 #include "libchess/UCIService.h"
 
+#include "dataset.h"
+#include "evaluation.h"
+#include "gradtune.h"
+#include "nnue.h"
+#include "perft.h"
+#include "pruning.h"
 #include "search.h"
 #include "tune.h"
 
+#ifndef USE_MPI_SEARCH
+#include "bench.h"
+#include "tt.h"
+#endif
+
 using namespace libchess;
 
 int main(int argc, char* argv[]) {
@@ -55,13 +67,95 @@ int main(int argc, char* argv[]) {
     };
     auto stop_handler = [&search_globals]() { search_globals.set_stop_flag(true); };
     auto display_handler = [&position](const std::istringstream&) { position.display(); };
+    auto perft_command_handler = [&position](std::istringstream& line_stream) {
+        perft_handler(position, line_stream, false);
+    };
+    auto divide_handler = [&position](std::istringstream& line_stream) {
+        perft_handler(position, line_stream, true);
+    };
+    auto evalstats_handler = [](std::istringstream& line_stream) {
+        auto stats = eval::eval_cache_stats();
+        double hit_rate = stats.probes ? 100.0 * stats.hits / stats.probes : 0.0;
+        std::cout << "info string evalcache probes " << stats.probes << " hits " << stats.hits
+                  << " hitrate " << hit_rate << "%\n";
+        std::string arg;
+        if (line_stream >> arg && arg == "reset") {
+            eval::reset_eval_cache_stats();
+        }
+    };
+#ifndef USE_MPI_SEARCH
+    // MPI workers run in their own processes and keep the default pruning, so the toggles are
+    // only offered where they apply to the whole search
+    auto pruning_handler = [](std::istringstream& line_stream) {
+        auto& options = search::pruning_options;
+        std::string name, value;
+        while (line_stream >> name >> value) {
+            bool enabled = value == "on";
+            if (name == "nullmove") {
+                options.null_move = enabled;
+            } else if (name == "lmr") {
+                options.late_move_reductions = enabled;
+            } else if (name == "rfp") {
+                options.reverse_futility = enabled;
+            }
+        }
+        std::cout << std::boolalpha << "info string pruning nullmove " << options.null_move
+                  << " lmr " << options.late_move_reductions << " rfp "
+                  << options.reverse_futility << std::noboolalpha << "\n";
+    };
+    auto nnue_handler = [](std::istringstream& line_stream) {
+        std::string command, path;
+        line_stream >> command >> std::quoted(path);
+        if (command == "load") {
+            if (eval::nnue::load(path)) {
+                std::cout << "info string loaded network from " << path << "\n";
+            } else {
+                std::cout << "info string failed to load network from " << path << "\n";
+            }
+        } else if (command == "off") {
+            eval::nnue::unload();
+        }
+        std::cout << "info string eval " << (eval::nnue::active() ? "nnue" : "handcrafted")
+                  << "\n";
+    };
+    auto savehash_handler = [](std::istringstream& line_stream) {
+        std::string path;
+        line_stream >> std::quoted(path);
+        if (tt.save(path)) {
+            std::cout << "info string saved hash to " << path << "\n";
+        } else {
+            std::cout << "info string failed to save hash to " << path << "\n";
+        }
+    };
+    auto loadhash_handler = [](std::istringstream& line_stream) {
+        std::string path;
+        line_stream >> std::quoted(path);
+        if (tt.load(path)) {
+            std::cout << "info string loaded hash from " << path << "\n";
+        } else {
+            std::cout << "info string failed to load hash from " << path << "\n";
+        }
+    };
+#endif
 
     UCIService uci_service{"LibchessEngine", "Manik Charan"};
     uci_service.register_position_handler(position_handler);
     uci_service.register_go_handler(go_handler);
     uci_service.register_stop_handler(stop_handler);
     uci_service.register_handler("d", display_handler, false);
+    uci_service.register_handler("perft", perft_command_handler, false);
+    uci_service.register_handler("divide", divide_handler, false);
     uci_service.register_handler("tune", tune_handler, false);
+    uci_service.register_handler("gradtune", gradtune_handler, false);
+    uci_service.register_handler("pack", pack_handler, false);
+    uci_service.register_handler("evalstats", evalstats_handler, false);
+#ifndef USE_MPI_SEARCH
+    uci_service.register_handler("bench", bench_handler, false);
+    uci_service.register_handler("pruning", pruning_handler, false);
+    uci_service.register_handler("nnue", nnue_handler, false);
+    uci_service.register_handler("savehash", savehash_handler, false);
+    uci_service.register_handler("loadhash", loadhash_handler, false);
+#endif
 
     std::string line;
     while (true) {
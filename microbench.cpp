@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "evaluation.h"
+#include "libchess/Position.h"
+#include "movepick.h"
+#include "search.h"
+#include "tt.h"
+
+using namespace libchess;
+
+// Timing loops for the hot paths of the search, each run in isolation over the bench positions.
+// Every repetition times one batch of operations; the first WARMUP_REPETITIONS are discarded so
+// caches, branch predictors and the CPU clock settle first.
+static const int WARMUP_REPETITIONS = 5;
+static const int DEFAULT_REPETITIONS = 51;
+
+// Results are folded in here so the compiler cannot drop the work being timed
+static volatile std::uint64_t sink;
+
+struct Timing {
+    double median_ns;
+    double p90_ns;
+    double min_ns;
+};
+
+template <class Batch>
+Timing measure(int repetitions, std::uint64_t ops_per_batch, Batch&& batch) {
+    for (int i = 0; i < WARMUP_REPETITIONS; ++i) {
+        sink = sink + batch();
+    }
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + batch();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count() / ops_per_batch);
+    }
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples[samples.size() * 9 / 10], samples.front()};
+}
+
+void report(const std::string& name, const Timing& timing) {
+    std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << timing.median_ns << std::setw(12)
+              << timing.p90_ns << std::setw(12) << timing.min_ns << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    int repetitions = argc > 1 ? std::max(1, std::atoi(argv[1])) : DEFAULT_REPETITIONS;
+
+    std::vector<Position> positions;
+    std::uint64_t legal_moves = 0;
+    for (auto fen : bench::POSITIONS) {
+        positions.push_back(*Position::from_fen(fen));
+        legal_moves += positions.back().legal_move_list().size();
+    }
+
+    std::cout << repetitions << " repetitions over " << positions.size() << " positions\n"
+              << std::left << std::setw(20) << "ns/op" << std::right << std::setw(12) << "median"
+              << std::setw(12) << "p90" << std::setw(12) << "min" << "\n";
+
+    report("evaluate", measure(repetitions, positions.size(), [&]() {
+               std::uint64_t sum = 0;
+               for (auto& pos : positions) {
+                   sum += eval::evaluate(pos);
+               }
+               return sum;
+           }));
+
+    report("evaluate_uncached", measure(repetitions, positions.size(), [&]() {
+               std::uint64_t sum = 0;
+               for (auto& pos : positions) {
+                   sum += eval::evaluate_uncached(pos);
+               }
+               return sum;
+           }));
+
+    // Move lists are generated outside the timed loop so only make and unmake are measured
+    std::vector<MoveList> move_lists;
+    for (auto& pos : positions) {
+        move_lists.push_back(pos.legal_move_list());
+    }
+    report("make/unmake", measure(repetitions, legal_moves, [&]() {
+               std::uint64_t sum = 0;
+               for (std::size_t i = 0; i < positions.size(); ++i) {
+                   for (auto move : move_lists[i]) {
+                       positions[i].make_move(move);
+                       sum += positions[i].hash();
+                       positions[i].unmake_move();
+                   }
+               }
+               return sum;
+           }));
+
+    // Keys spread over a table larger than the caches, as in a real search
+    const std::uint64_t TT_OPS = 1 << 16;
+    std::vector<std::uint64_t> keys(TT_OPS);
+    std::uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (auto& key : keys) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        key = state;
+    }
+    report("tt write", measure(repetitions, TT_OPS, [&]() {
+               for (std::uint64_t i = 0; i < TT_OPS; ++i) {
+                   tt.write(i & 0xffff, TTConstants::FLAG_EXACT, 1 + i % 16, 0, keys[i]);
+               }
+               return std::uint64_t(0);
+           }));
+    report("tt probe", measure(repetitions, TT_OPS, [&]() {
+               std::uint64_t hits = 0;
+               for (auto key : keys) {
+                   hits += tt.probe(key).get_key() == key;
+               }
+               return hits;
+           }));
+
+    // Generation, scoring and selection of every move, as the search sees them at a node
+    const search::MoveHistory history{};
+    const std::array<Move, 2> killers{Move{0}, Move{0}};
+    report("move picking", measure(repetitions, legal_moves, [&]() {
+               using search::MovePicker;
+               std::uint64_t sum = 0;
+               for (auto& pos : positions) {
+                   auto picker = MovePicker::new_main_picker(pos, Move{0}, killers, history);
+                   while (auto move = picker.next_move()) {
+                       sum += move->value();
+                   }
+               }
+               return sum;
+           }));
+
+    // The stack is allocated once, so only the search itself is timed and not clearing its frames
+    auto search_stack = search::SearchStack::new_search_stack();
+    auto search_globals = search::SearchGlobals::new_search_globals();
+    tt.clear();
+    report("qsearch", measure(repetitions, positions.size(), [&]() {
+               std::uint64_t sum = 0;
+               for (auto& pos : positions) {
+                   sum += search::qsearch_impl(pos, -search::INFINITE, +search::INFINITE,
+                                               search_stack.begin(), search_globals);
+               }
+               return sum;
+           }));
+
+    return 0;
+}
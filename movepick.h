@@ -0,0 +1,366 @@
+#ifndef MOVEPICK_H
+#define MOVEPICK_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <optional>
+
+#include "libchess/Position.h"
+#include "movescore.h"
+#include "see.h"
+
+namespace search {
+
+inline libchess::Bitboard piece_attacks(libchess::PieceType pt, libchess::Square square,
+                                        libchess::Color color, libchess::Bitboard occupancy) {
+    using namespace libchess;
+    if (pt == constants::PAWN) {
+        return lookups::pawn_attacks(square, color);
+    } else if (pt == constants::KNIGHT) {
+        return lookups::knight_attacks(square);
+    } else if (pt == constants::BISHOP) {
+        return lookups::bishop_attacks(square, occupancy);
+    } else if (pt == constants::ROOK) {
+        return lookups::rook_attacks(square, occupancy);
+    } else if (pt == constants::QUEEN) {
+        return lookups::queen_attacks(square, occupancy);
+    } else {
+        return lookups::king_attacks(square);
+    }
+}
+
+// Quiet move ordering statistics: a butterfly history indexed by side, from and to square, and
+// the move that last refuted each previous move
+struct MoveHistory {
+    static const int MAX_HISTORY = 16384;
+
+    void age() noexcept {
+        for (auto& side : butterfly) {
+            for (auto& from : side) {
+                for (auto& entry : from) {
+                    entry /= 2;
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] int quiet_score(libchess::Color stm, libchess::Move move) const noexcept {
+        return butterfly[stm.value()][move.from_square().value()][move.to_square().value()];
+    }
+
+    [[nodiscard]] libchess::Move counter_move(const libchess::Position& pos) const {
+        auto previous_move = pos.previous_move();
+        if (!previous_move || !previous_move->value()) {
+            return libchess::Move{0};
+        }
+        return countermoves[previous_move->from_square().value()]
+                           [previous_move->to_square().value()];
+    }
+
+    // Called with the quiet move that failed high and the quiets searched before it at that node
+    void update(const libchess::Position& pos, libchess::Move best, const libchess::Move* quiets,
+                int quiet_count, int depth) {
+        int bonus = std::min(depth * depth, 400);
+        auto stm = pos.side_to_move();
+        add_bonus(stm, best, bonus);
+        for (int i = 0; i < quiet_count; ++i) {
+            if (quiets[i] != best) {
+                add_bonus(stm, quiets[i], -bonus);
+            }
+        }
+
+        auto previous_move = pos.previous_move();
+        if (previous_move && previous_move->value()) {
+            countermoves[previous_move->from_square().value()]
+                        [previous_move->to_square().value()] = best;
+        }
+    }
+
+    std::array<std::array<std::array<int, 64>, 64>, 2> butterfly;
+    std::array<std::array<libchess::Move, 64>, 64> countermoves;
+    std::uint32_t generation;
+
+  private:
+    // Bonuses shrink as an entry approaches MAX_HISTORY so the table never saturates
+    void add_bonus(libchess::Color stm, libchess::Move move, int bonus) noexcept {
+        int& entry = butterfly[stm.value()][move.from_square().value()][move.to_square().value()];
+        entry += bonus - entry * std::abs(bonus) / MAX_HISTORY;
+    }
+};
+
+inline std::atomic<std::uint32_t> history_generation{1};
+// Tables last used before this generation are emptied rather than aged
+inline std::atomic<std::uint32_t> history_cleared_generation{0};
+
+// Called once per search. Threads age their tables the next time they look them up.
+inline void new_search_history() { history_generation.fetch_add(1, std::memory_order_relaxed); }
+
+// For searches that must not depend on earlier ones, such as those of bench
+inline void clear_search_history() {
+    auto generation = history_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    history_cleared_generation.store(generation, std::memory_order_relaxed);
+}
+
+// History tables are per thread so parallel searches never contend on them
+inline MoveHistory& thread_history() {
+    thread_local MoveHistory history{};
+    std::uint32_t generation = history_generation.load(std::memory_order_relaxed);
+    if (history.generation != generation) {
+        if (history.generation < history_cleared_generation.load(std::memory_order_relaxed)) {
+            history = MoveHistory{};
+        } else {
+            history.age();
+        }
+        history.generation = generation;
+    }
+    return history;
+}
+
+// Whether a move read from the transposition table or a killer slot could have been produced by
+// the move generator in this position. A hash collision can hand us any move, so this must hold before
+// is_legal_generated_move may be asked about it.
+inline bool is_pseudo_legal(const libchess::Position& pos, libchess::Move move) {
+    using namespace libchess;
+    if (!move.value()) {
+        return false;
+    }
+
+    Color stm = pos.side_to_move();
+    Square from = move.from_square();
+    Square to = move.to_square();
+    Bitboard to_bb{to};
+    if (!(pos.color_bb(stm) & Bitboard{from}) || (pos.color_bb(stm) & to_bb)) {
+        return false;
+    }
+
+    auto type = move.type();
+    if (type == Move::Type::CASTLING) {
+        MoveList quiets;
+        pos.generate_quiet_moves(quiets, stm);
+        return std::find(quiets.begin(), quiets.end(), move) != quiets.end();
+    }
+
+    auto pt = *pos.piece_type_on(from);
+    auto captured = pos.piece_type_on(to);
+    if (type == Move::Type::ENPASSANT) {
+        auto ep_square = pos.enpassant_square();
+        return pt == constants::PAWN && ep_square && *ep_square == to &&
+               (lookups::pawn_attacks(from, stm) & to_bb);
+    }
+
+    bool is_capture = type == Move::Type::CAPTURE || type == Move::Type::CAPTURE_PROMOTION;
+    bool is_promotion = type == Move::Type::PROMOTION || type == Move::Type::CAPTURE_PROMOTION;
+    if (is_capture != bool(captured) || (captured && *captured == constants::KING)) {
+        return false;
+    }
+
+    if (pt != constants::PAWN) {
+        return !is_promotion && type != Move::Type::DOUBLE_PUSH &&
+               (piece_attacks(pt, from, stm, pos.occupancy_bb()) & to_bb);
+    }
+
+    if (is_promotion != bool(lookups::relative_rank_mask(constants::RANK_8, stm) & to_bb)) {
+        return false;
+    }
+    if (is_capture) {
+        return bool(lookups::pawn_attacks(from, stm) & to_bb);
+    }
+
+    int push = stm == constants::WHITE ? 8 : -8;
+    Square single_push{from.value() + push};
+    if (type == Move::Type::DOUBLE_PUSH) {
+        return (lookups::relative_rank_mask(constants::RANK_2, stm) & Bitboard{from}) &&
+               !(pos.occupancy_bb() & Bitboard{single_push}) &&
+               to.value() == single_push.value() + push;
+    }
+    return to == single_push;
+}
+
+// Hands out the moves of a node one at a time, best first: the TT move, captures and
+// promotions by MVV-LVA, the killers and countermove, quiets by history, and last the captures
+// that lose material according to SEE. Each stage is generated only once the previous
+// one is exhausted and only moves that pass the legality check are returned, so a cutoff on an
+// early move skips the remaining generation and sorting altogether. In check all evasions are
+// generated together instead. Quiescence pickers stop after the captures.
+class MovePicker {
+  public:
+    static MovePicker new_main_picker(const libchess::Position& pos, libchess::Move tt_move,
+                                      const std::array<libchess::Move, 2>& killers,
+                                      const MoveHistory& history) {
+        return MovePicker{
+            pos, tt_move, {killers[0], killers[1], history.counter_move(pos)}, &history, false};
+    }
+
+    static MovePicker new_qsearch_picker(const libchess::Position& pos, libchess::Move tt_move) {
+        return MovePicker{pos, tt_move, {}, nullptr, true};
+    }
+
+    std::optional<libchess::Move> next_move() {
+        using namespace libchess;
+        while (true) {
+            switch (stage_) {
+            case Stage::TT_MOVE:
+                stage_ = Stage::GENERATE_CAPTURES;
+                if (is_pseudo_legal(pos_, tt_move_) && (!qsearch_ || is_noisy(tt_move_)) &&
+                    pos_.is_legal_generated_move(tt_move_)) {
+                    return tt_move_;
+                }
+                break;
+            case Stage::GENERATE_CAPTURES: {
+                MoveList move_list;
+                pos_.generate_capture_moves(move_list, pos_.side_to_move());
+                pos_.generate_promotions(move_list, pos_.side_to_move());
+                add_moves(move_list);
+                stage_ = Stage::CAPTURES;
+                break;
+            }
+            case Stage::CAPTURES:
+                if (auto move = select_next()) {
+                    // Quiescence search prunes losing captures itself
+                    if (qsearch_ || bad_capture_count_ == int(bad_captures_.size()) ||
+                        see(pos_, *move) >= 0) {
+                        return move;
+                    }
+                    bad_captures_[bad_capture_count_++] = *move;
+                    break;
+                }
+                stage_ = qsearch_ ? Stage::DONE : Stage::REFUTATIONS;
+                break;
+            case Stage::REFUTATIONS:
+                while (refutation_index_ < int(refutations_.size())) {
+                    auto refutation_it = refutations_.begin() + refutation_index_++;
+                    Move refutation = *refutation_it;
+                    if (refutation != tt_move_ &&
+                        std::find(refutations_.begin(), refutation_it, refutation) ==
+                            refutation_it &&
+                        is_pseudo_legal(pos_, refutation) && !is_noisy(refutation) &&
+                        pos_.is_legal_generated_move(refutation)) {
+                        return refutation;
+                    }
+                }
+                stage_ = Stage::GENERATE_QUIETS;
+                break;
+            case Stage::GENERATE_QUIETS: {
+                MoveList move_list;
+                pos_.generate_quiet_moves(move_list, pos_.side_to_move());
+                add_moves(move_list);
+                stage_ = Stage::QUIETS;
+                break;
+            }
+            case Stage::QUIETS:
+                if (auto move = select_next()) {
+                    return move;
+                }
+                stage_ = Stage::BAD_CAPTURES;
+                break;
+            case Stage::BAD_CAPTURES:
+                if (bad_capture_index_ < bad_capture_count_) {
+                    return bad_captures_[bad_capture_index_++];
+                }
+                stage_ = Stage::DONE;
+                break;
+            case Stage::GENERATE_EVASIONS:
+                add_moves(pos_.check_evasion_move_list());
+                stage_ = Stage::EVASIONS;
+                break;
+            case Stage::EVASIONS:
+                if (auto move = select_next()) {
+                    return move;
+                }
+                stage_ = Stage::DONE;
+                break;
+            case Stage::DONE:
+                return {};
+            }
+        }
+    }
+
+  private:
+    enum class Stage {
+        TT_MOVE,
+        GENERATE_CAPTURES,
+        CAPTURES,
+        REFUTATIONS,
+        GENERATE_QUIETS,
+        QUIETS,
+        BAD_CAPTURES,
+        GENERATE_EVASIONS,
+        EVASIONS,
+        DONE
+    };
+
+    static const int QUIET_SORT_LIMIT = 0;
+
+    MovePicker(const libchess::Position& pos, libchess::Move tt_move,
+               const std::array<libchess::Move, 3>& refutations, const MoveHistory* history,
+               bool qsearch) noexcept
+        : pos_(pos), tt_move_(tt_move), refutations_(refutations), history_(history),
+          qsearch_(qsearch),
+          // Evasions are generated as a whole, so the TT move is only ranked first among them
+          stage_(pos.in_check() ? Stage::GENERATE_EVASIONS : Stage::TT_MOVE),
+          refutation_index_(0), bad_capture_count_(0), bad_capture_index_(0), index_(0) {}
+
+    int score(libchess::Move move) const {
+        if (move == tt_move_) {
+            return 1 << 30;
+        }
+        if (!is_noisy(move)) {
+            return history_ ? history_->quiet_score(pos_.side_to_move(), move) : 0;
+        }
+        // Captures stay ahead of every quiet when evasions are ordered together
+        return 2 * MoveHistory::MAX_HISTORY + mvv_lva_score(pos_, move);
+    }
+
+    template <class List>
+    void add_moves(const List& move_list) {
+        moves_.clear();
+        index_ = 0;
+        for (auto move : move_list) {
+            // In evasions the TT move is kept and scored first; elsewhere it was already tried, as
+            // were the refutations by the time quiets are generated
+            if (stage_ != Stage::GENERATE_EVASIONS &&
+                (move == tt_move_ ||
+                 (stage_ == Stage::GENERATE_QUIETS &&
+                  std::find(refutations_.begin(), refutations_.end(), move) !=
+                      refutations_.end()))) {
+                continue;
+            }
+            moves_.add(move, score(move));
+        }
+        // Quiets with a poor history are rarely reached before a cutoff, so they are left unsorted
+        moves_.partial_insertion_sort(stage_ == Stage::GENERATE_QUIETS
+                                          ? QUIET_SORT_LIMIT
+                                          : std::numeric_limits<int>::min());
+    }
+
+    std::optional<libchess::Move> select_next() {
+        while (index_ < moves_.size()) {
+            libchess::Move move = moves_[index_++].move;
+            if (pos_.is_legal_generated_move(move)) {
+                return move;
+            }
+        }
+        return {};
+    }
+
+    const libchess::Position& pos_;
+    libchess::Move tt_move_;
+    std::array<libchess::Move, 3> refutations_;
+    const MoveHistory* history_;
+    bool qsearch_;
+    Stage stage_;
+    int refutation_index_;
+    int bad_capture_count_;
+    int bad_capture_index_;
+    int index_;
+    ScoredMoveList moves_;
+    std::array<libchess::Move, 32> bad_captures_;
+};
+
+} // namespace search
+
+#endif // MOVEPICK_H
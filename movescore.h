@@ -0,0 +1,112 @@
+#ifndef MOVESCORE_H
+#define MOVESCORE_H
+
+#include <array>
+#include <limits>
+
+#include "libchess/Position.h"
+
+namespace search {
+
+inline bool is_noisy(libchess::Move move) noexcept {
+    auto type = move.type();
+    return type == libchess::Move::Type::CAPTURE || type == libchess::Move::Type::ENPASSANT ||
+           type == libchess::Move::Type::PROMOTION ||
+           type == libchess::Move::Type::CAPTURE_PROMOTION;
+}
+
+// Index used for "no piece" in the tables below: the victim of a quiet promotion and the
+// promotion piece of every other move
+static const int NO_PIECE_TYPE = 6;
+
+// Most valuable victim, least valuable attacker, indexed [victim][attacker]. The victim's rank
+// dominates and the attacker only breaks ties, so every capture of a queen precedes every
+// capture of a rook and so on.
+inline constexpr std::array<std::array<int, 6>, 7> MVV_LVA = []() {
+    std::array<std::array<int, 6>, 7> table{};
+    for (int victim = 0; victim < 7; ++victim) {
+        for (int attacker = 0; attacker < 6; ++attacker) {
+            int victim_rank = victim == NO_PIECE_TYPE ? 0 : victim + 1;
+            table[victim][attacker] = 8 * victim_rank - (attacker + 1);
+        }
+    }
+    return table;
+}();
+
+inline constexpr std::array<int, 7> PROMOTION_BONUS{0, 16, 24, 32, 40, 0, 0};
+
+// Ordering score of a capture or promotion; the lookups replace comparisons of material values
+inline int mvv_lva_score(const libchess::Position& pos, libchess::Move move) {
+    using namespace libchess;
+    auto captured = pos.piece_type_on(move.to_square());
+    auto promotion = move.promotion_piece_type();
+    // En passant lands on an empty square but always takes a pawn
+    int victim = move.type() == Move::Type::ENPASSANT ? constants::PAWN.value()
+                 : captured                           ? captured->value()
+                                                      : NO_PIECE_TYPE;
+    int attacker = pos.piece_type_on(move.from_square())->value();
+    int promoted = promotion ? promotion->value() : NO_PIECE_TYPE;
+    return MVV_LVA[victim][attacker] + PROMOTION_BONUS[promoted];
+}
+
+struct ScoredMove {
+    libchess::Move move;
+    int score;
+};
+
+// Fixed capacity buffer of moves kept next to their ordering scores
+class ScoredMoveList {
+  public:
+    static const int MAX_MOVES = 256;
+
+    void clear() noexcept { size_ = 0; }
+    void add(libchess::Move move, int score) noexcept { moves_[size_++] = {move, score}; }
+
+    // Sorts the moves scoring at least limit in descending order to the front and leaves the
+    // rest behind them in generation order. Move lists are short and mostly consumed from the
+    // front, where insertion sort beats a full sort.
+    void partial_insertion_sort(int limit = std::numeric_limits<int>::min()) noexcept {
+        ScoredMove* begin = moves_.data();
+        ScoredMove* end = begin + size_;
+        for (ScoredMove *sorted_end = begin, *p = begin + 1; p < end; ++p) {
+            if (p->score >= limit) {
+                ScoredMove scored_move = *p;
+                *p = *++sorted_end;
+                ScoredMove* q = sorted_end;
+                for (; q != begin && (q - 1)->score < scored_move.score; --q) {
+                    *q = *(q - 1);
+                }
+                *q = scored_move;
+            }
+        }
+    }
+
+    [[nodiscard]] int size() const noexcept { return size_; }
+    [[nodiscard]] const ScoredMove& operator[](int index) const noexcept { return moves_[index]; }
+    [[nodiscard]] const ScoredMove* begin() const noexcept { return moves_.data(); }
+    [[nodiscard]] const ScoredMove* end() const noexcept { return moves_.data() + size_; }
+
+  private:
+    int size_ = 0;
+    std::array<ScoredMove, MAX_MOVES> moves_;
+};
+
+// Orders a complete move list, captures first by MVV-LVA, for the callers that hand every move
+// out at once instead of going through a MovePicker
+inline void order_moves(const libchess::Position& pos, libchess::MoveList& move_list) {
+    ScoredMoveList scored_moves;
+    for (auto move : move_list) {
+        scored_moves.add(move, is_noisy(move) ? 1000 + mvv_lva_score(pos, move) : 0);
+    }
+    scored_moves.partial_insertion_sort();
+
+    libchess::MoveList ordered;
+    for (const auto& scored_move : scored_moves) {
+        ordered.add(scored_move.move);
+    }
+    move_list = ordered;
+}
+
+} // namespace search
+
+#endif // MOVESCORE_H
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evaluation.h"
+#include "nnue.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NNUE_X86
+#endif
+
+using namespace libchess;
+
+namespace eval::nnue {
+
+namespace {
+
+// Network files are little endian: this header, then the feature transformer biases and
+// weights (int16), then for each hidden layer and the output its int32 biases followed by its
+// int8 weights, one row per output.
+struct NetworkFileHeader {
+    char magic[8];
+    std::uint32_t inputs;
+    std::uint32_t hidden;
+    std::uint32_t hidden1;
+    std::uint32_t hidden2;
+    char reserved[8];
+};
+
+const char NETWORK_FILE_MAGIC[8] = {'L', 'C', 'E', 'N', 'N', '0', '1', '\0'};
+
+// Hidden layer weights are scaled by 1 << WEIGHT_SHIFT and activations are clipped to
+// [0, ACTIVATION_MAX]; the output is divided by OUTPUT_SCALE to give centipawns
+constexpr int WEIGHT_SHIFT = 6;
+constexpr int ACTIVATION_MAX = 127;
+constexpr int OUTPUT_SCALE = 16;
+
+// At most 30 non-king pieces, so refreshes are accumulated in one pass
+constexpr int MAX_ACTIVE_FEATURES = 32;
+
+static_assert(HIDDEN % 32 == 0 && HIDDEN1 % 32 == 0 && HIDDEN2 % 32 == 0,
+              "layer sizes must fill whole AVX2 registers");
+
+struct Network {
+    const std::int16_t* feature_biases;
+    const std::int16_t* feature_weights;
+    const std::int32_t* hidden1_biases;
+    const std::int8_t* hidden1_weights;
+    const std::int32_t* hidden2_biases;
+    const std::int8_t* hidden2_weights;
+    const std::int32_t* output_bias;
+    const std::int8_t* output_weights;
+};
+
+Network network;
+bool network_active = false;
+void* mapping = nullptr;
+std::size_t mapping_bytes = 0;
+
+void release_mapping() {
+    if (mapping) {
+        munmap(mapping, mapping_bytes);
+        mapping = nullptr;
+        mapping_bytes = 0;
+    }
+}
+
+int feature_index(Color perspective, Square king_sq, const PieceSquare& piece) {
+    int king = king_sq.value();
+    int sq = piece.square.value();
+    if (perspective == constants::BLACK) {
+        king ^= 56;
+        sq ^= 56;
+    }
+    int kind = (piece.color == perspective ? 0 : 5) + piece.piece_type.value();
+    return (king * PIECE_KINDS + kind) * 64 + sq;
+}
+
+Square king_square(const Position& pos, Color color) {
+    return pos.piece_type_bb(constants::KING, color).forward_bitscan();
+}
+
+// The three kernels below come in AVX2, SSE4.1 and portable versions, picked once at startup.
+// accumulate: out = base + the added weight rows - the removed weight rows
+// clipped_relu: clamps int16 activations to [0, ACTIVATION_MAX] as bytes
+// dot: sum of byte activations times int8 weights
+struct Kernels {
+    void (*accumulate)(const std::int16_t* base, std::int16_t* out, const int* added,
+                       int num_added, const int* removed, int num_removed);
+    void (*clipped_relu)(const std::int16_t* input, std::uint8_t* output, int size);
+    std::int32_t (*dot)(const std::uint8_t* input, const std::int8_t* weights, int size);
+};
+
+void accumulate_portable(const std::int16_t* base, std::int16_t* out, const int* added,
+                         int num_added, const int* removed, int num_removed) {
+    std::copy(base, base + HIDDEN, out);
+    for (int f = 0; f < num_added; ++f) {
+        const std::int16_t* row = network.feature_weights + added[f] * HIDDEN;
+        for (int i = 0; i < HIDDEN; ++i) {
+            out[i] += row[i];
+        }
+    }
+    for (int f = 0; f < num_removed; ++f) {
+        const std::int16_t* row = network.feature_weights + removed[f] * HIDDEN;
+        for (int i = 0; i < HIDDEN; ++i) {
+            out[i] -= row[i];
+        }
+    }
+}
+
+void clipped_relu_portable(const std::int16_t* input, std::uint8_t* output, int size) {
+    for (int i = 0; i < size; ++i) {
+        output[i] = std::uint8_t(std::clamp(int(input[i]), 0, ACTIVATION_MAX));
+    }
+}
+
+std::int32_t dot_portable(const std::uint8_t* input, const std::int8_t* weights, int size) {
+    std::int32_t sum = 0;
+    for (int i = 0; i < size; ++i) {
+        sum += input[i] * weights[i];
+    }
+    return sum;
+}
+
+#ifdef NNUE_X86
+__attribute__((target("avx2"))) void accumulate_avx2(const std::int16_t* base, std::int16_t* out,
+                                                     const int* added, int num_added,
+                                                     const int* removed, int num_removed) {
+    // One register's worth of every row at a time, so out is written once
+    for (int i = 0; i < HIDDEN; i += 16) {
+        auto sum = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + i));
+        for (int f = 0; f < num_added; ++f) {
+            const std::int16_t* row = network.feature_weights + added[f] * HIDDEN;
+            sum = _mm256_add_epi16(sum,
+                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+        }
+        for (int f = 0; f < num_removed; ++f) {
+            const std::int16_t* row = network.feature_weights + removed[f] * HIDDEN;
+            sum = _mm256_sub_epi16(sum,
+                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), sum);
+    }
+}
+
+__attribute__((target("avx2"))) void clipped_relu_avx2(const std::int16_t* input,
+                                                       std::uint8_t* output, int size) {
+    auto max = _mm256_set1_epi8(ACTIVATION_MAX);
+    for (int i = 0; i < size; i += 32) {
+        auto low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        auto high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i + 16));
+        // packus saturates negatives to 0 but interleaves the 128-bit lanes of its inputs
+        auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0b11011000);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_min_epu8(packed, max));
+    }
+}
+
+__attribute__((target("avx2"))) std::int32_t dot_avx2(const std::uint8_t* input,
+                                                      const std::int8_t* weights, int size) {
+    auto ones = _mm256_set1_epi16(1);
+    auto sum = _mm256_setzero_si256();
+    for (int i = 0; i < size; i += 32) {
+        // Activations are at most 127, so the pairwise int16 sums cannot saturate
+        auto products = _mm256_maddubs_epi16(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)),
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+    }
+    auto sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0b01001110));
+    sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0b10110001));
+    return _mm_cvtsi128_si32(sum128);
+}
+
+__attribute__((target("sse4.1"))) void accumulate_sse41(const std::int16_t* base,
+                                                        std::int16_t* out, const int* added,
+                                                        int num_added, const int* removed,
+                                                        int num_removed) {
+    for (int i = 0; i < HIDDEN; i += 8) {
+        auto sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + i));
+        for (int f = 0; f < num_added; ++f) {
+            const std::int16_t* row = network.feature_weights + added[f] * HIDDEN;
+            sum = _mm_add_epi16(sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        }
+        for (int f = 0; f < num_removed; ++f) {
+            const std::int16_t* row = network.feature_weights + removed[f] * HIDDEN;
+            sum = _mm_sub_epi16(sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), sum);
+    }
+}
+
+__attribute__((target("sse4.1"))) void clipped_relu_sse41(const std::int16_t* input,
+                                                          std::uint8_t* output, int size) {
+    auto max = _mm_set1_epi8(ACTIVATION_MAX);
+    for (int i = 0; i < size; i += 16) {
+        auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i + 8));
+        auto packed = _mm_packus_epi16(low, high);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_min_epu8(packed, max));
+    }
+}
+
+__attribute__((target("sse4.1"))) std::int32_t dot_sse41(const std::uint8_t* input,
+                                                         const std::int8_t* weights, int size) {
+    auto ones = _mm_set1_epi16(1);
+    auto sum = _mm_setzero_si128();
+    for (int i = 0; i < size; i += 16) {
+        auto products =
+            _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)),
+                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b01001110));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b10110001));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+Kernels select_kernels() {
+#ifdef NNUE_X86
+    // Runs from a static initializer, possibly before the CPU model has been read
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {accumulate_avx2, clipped_relu_avx2, dot_avx2};
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return {accumulate_sse41, clipped_relu_sse41, dot_sse41};
+    }
+#endif
+    return {accumulate_portable, clipped_relu_portable, dot_portable};
+}
+
+const Kernels kernels = select_kernels();
+
+void refresh_perspective(const Position& pos, Color perspective, Accumulator& accumulator) {
+    Square king_sq = king_square(pos, perspective);
+    int features[MAX_ACTIVE_FEATURES];
+    int num_features = 0;
+    for (auto& color : constants::COLORS) {
+        for (auto& piece_type : constants::PIECE_TYPES) {
+            if (piece_type == constants::KING) {
+                continue;
+            }
+            Bitboard bb = pos.piece_type_bb(piece_type, color);
+            while (bb) {
+                Square sq = bb.forward_bitscan();
+                bb.forward_popbit();
+                features[num_features++] =
+                    feature_index(perspective, king_sq, {color, piece_type, sq});
+            }
+        }
+    }
+    kernels.accumulate(network.feature_biases, accumulator.values[perspective].data(), features,
+                       num_features, nullptr, 0);
+}
+
+// Hidden layer: out = clipped((biases + weights . input) >> WEIGHT_SHIFT)
+void propagate(const std::uint8_t* input, int input_size, const std::int32_t* biases,
+               const std::int8_t* weights, std::uint8_t* output, int output_size) {
+    for (int i = 0; i < output_size; ++i) {
+        std::int32_t sum = biases[i] + kernels.dot(input, weights + i * input_size, input_size);
+        output[i] = std::uint8_t(std::clamp(sum >> WEIGHT_SHIFT, 0, ACTIVATION_MAX));
+    }
+}
+
+} // namespace
+
+bool load(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    constexpr std::size_t network_bytes =
+        HIDDEN * sizeof(std::int16_t) + std::size_t(INPUTS) * HIDDEN * sizeof(std::int16_t) +
+        HIDDEN1 * sizeof(std::int32_t) + HIDDEN1 * 2 * HIDDEN + HIDDEN2 * sizeof(std::int32_t) +
+        HIDDEN2 * HIDDEN1 + sizeof(std::int32_t) + HIDDEN2;
+
+    struct stat st;
+    NetworkFileHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+                 std::memcmp(header.magic, NETWORK_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.inputs == INPUTS && header.hidden == HIDDEN &&
+                 header.hidden1 == HIDDEN1 && header.hidden2 == HIDDEN2 &&
+                 std::size_t(st.st_size) == sizeof(header) + network_bytes;
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    release_mapping();
+    mapping = base;
+    mapping_bytes = st.st_size;
+
+    const char* data = static_cast<const char*>(base) + sizeof(header);
+    auto take = [&data](auto*& section, std::size_t count) {
+        section = reinterpret_cast<std::remove_reference_t<decltype(section)>>(data);
+        data += count * sizeof(*section);
+    };
+    take(network.feature_biases, HIDDEN);
+    take(network.feature_weights, std::size_t(INPUTS) * HIDDEN);
+    take(network.hidden1_biases, HIDDEN1);
+    take(network.hidden1_weights, HIDDEN1 * 2 * HIDDEN);
+    take(network.hidden2_biases, HIDDEN2);
+    take(network.hidden2_weights, HIDDEN2 * HIDDEN1);
+    take(network.output_bias, 1);
+    take(network.output_weights, HIDDEN2);
+
+    network_active = true;
+    invalidate_caches();
+    return true;
+}
+
+void unload() {
+    network_active = false;
+    release_mapping();
+    invalidate_caches();
+}
+
+bool active() noexcept { return network_active; }
+
+Accumulator* thread_accumulator(int ply) {
+    thread_local std::deque<Accumulator> accumulators;
+    while (int(accumulators.size()) <= ply) {
+        accumulators.emplace_back();
+    }
+    return &accumulators[ply];
+}
+
+void refresh(const Position& pos, Accumulator& accumulator) {
+    for (auto& color : constants::COLORS) {
+        refresh_perspective(pos, color, accumulator);
+    }
+}
+
+void update(const Position& pos, const DirtyPieces& dirty, const Accumulator& parent,
+            Accumulator& child) {
+    for (auto& perspective : constants::COLORS) {
+        Square king_sq = king_square(pos, perspective);
+        int added[2];
+        int removed[2];
+        for (int i = 0; i < dirty.num_added; ++i) {
+            added[i] = feature_index(perspective, king_sq, dirty.added[i]);
+        }
+        for (int i = 0; i < dirty.num_removed; ++i) {
+            removed[i] = feature_index(perspective, king_sq, dirty.removed[i]);
+        }
+        kernels.accumulate(parent.values[perspective].data(), child.values[perspective].data(),
+                           added, dirty.num_added, removed, dirty.num_removed);
+    }
+}
+
+int evaluate(const Position& pos, const Accumulator& accumulator) {
+    Color stm = pos.side_to_move();
+    alignas(32) std::array<std::uint8_t, 2 * HIDDEN> input;
+    kernels.clipped_relu(accumulator.values[stm].data(), input.data(), HIDDEN);
+    kernels.clipped_relu(accumulator.values[!stm].data(), input.data() + HIDDEN, HIDDEN);
+
+    alignas(32) std::array<std::uint8_t, HIDDEN1> hidden1;
+    alignas(32) std::array<std::uint8_t, HIDDEN2> hidden2;
+    propagate(input.data(), 2 * HIDDEN, network.hidden1_biases, network.hidden1_weights,
+              hidden1.data(), HIDDEN1);
+    propagate(hidden1.data(), HIDDEN1, network.hidden2_biases, network.hidden2_weights,
+              hidden2.data(), HIDDEN2);
+
+    std::int32_t output =
+        *network.output_bias + kernels.dot(hidden2.data(), network.output_weights, HIDDEN2);
+    return output / OUTPUT_SCALE;
+}
+
+int evaluate(const Position& pos) {
+    Accumulator accumulator;
+    refresh(pos, accumulator);
+    return evaluate(pos, accumulator);
+}
+
+} // namespace eval::nnue
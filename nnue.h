@@ -0,0 +1,70 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "libchess/Position.h"
+
+namespace eval::nnue {
+
+// HalfKP: every non-king piece is a feature relative to each side's king, seen from that side
+static const int KING_SQUARES = 64;
+static const int PIECE_KINDS = 10;
+static const int INPUTS = KING_SQUARES * PIECE_KINDS * 64;
+static const int HIDDEN = 256;
+static const int HIDDEN1 = 32;
+static const int HIDDEN2 = 32;
+
+// The feature transformer output of both perspectives, indexed by color. Each is the bias plus
+// the weight rows of that side's active features and changes by a few rows per move.
+struct Accumulator {
+    alignas(32) std::array<std::array<std::int16_t, HIDDEN>, 2> values;
+};
+
+struct PieceSquare {
+    libchess::Color color;
+    libchess::PieceType piece_type;
+    libchess::Square square;
+};
+
+// The pieces a move takes off and puts on the board. Kings are not features, so king moves
+// change every feature of their own side and refresh that accumulator instead.
+struct DirtyPieces {
+    void add(libchess::Color color, libchess::PieceType pt, libchess::Square sq) noexcept {
+        added[num_added++] = {color, pt, sq};
+    }
+    void remove(libchess::Color color, libchess::PieceType pt, libchess::Square sq) noexcept {
+        removed[num_removed++] = {color, pt, sq};
+    }
+
+    std::array<PieceSquare, 2> added;
+    std::array<PieceSquare, 2> removed;
+    int num_added = 0;
+    int num_removed = 0;
+};
+
+// Maps a network file read-only and switches evaluation over to it. Returns false, keeping the
+// current evaluation, if the file is missing or does not match this architecture.
+bool load(const std::string& path);
+// Returns evaluation to the handcrafted terms
+void unload();
+[[nodiscard]] bool active() noexcept;
+
+// The calling thread's accumulator for a search ply. They are kept apart from the search stack,
+// which stays small while no network is loaded, and never move once created.
+Accumulator* thread_accumulator(int ply);
+
+void refresh(const libchess::Position& pos, Accumulator& accumulator);
+// pos is the position before the move, which must not be a king move
+void update(const libchess::Position& pos, const DirtyPieces& dirty, const Accumulator& parent,
+            Accumulator& child);
+
+// Network output from the side to move's point of view, in centipawns
+int evaluate(const libchess::Position& pos, const Accumulator& accumulator);
+int evaluate(const libchess::Position& pos);
+
+} // namespace eval::nnue
+
+#endif // NNUE_H
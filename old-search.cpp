@@ -1,7 +1,10 @@
 #include <chrono>
 
 #include "evaluation.h"
+#include "movepick.h"
+#include "pruning.h"
 #include "search.h"
+#include "see.h"
 
 #include "tt.h"
 
@@ -11,41 +14,16 @@ using namespace eval;
 namespace search {
 
 // SearchStack implementation
-std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
-    std::array<SearchStack, MAX_PLY> search_stack{};
+std::array<SearchStack, SEARCH_STACK_SIZE> SearchStack::new_search_stack() noexcept {
+    std::array<SearchStack, SEARCH_STACK_SIZE> search_stack{};
     for (unsigned i = 0; i < search_stack.size(); ++i) {
         auto& ss = search_stack[i];
         ss.ply = int(i);
+        ss.static_eval = NO_STATIC_EVAL;
     }
     return search_stack;
 }
 
-void sort_moves(const Position& pos, MoveList& move_list, SearchStack* ss,
-                std::optional<Move> tt_move = {}) {
-    move_list.sort([&](Move move) {
-        auto from_pt = *pos.piece_type_on(move.from_square());
-        auto to_pt = pos.piece_type_on(move.to_square());
-
-        int pawn_value = eval::MATERIAL[constants::PAWN][MIDGAME];
-        int equality_bound = pawn_value - 50;
-        if (tt_move && move == *tt_move) {
-            return 20000;
-        } else if (move.type() == Move::Type::ENPASSANT) {
-            return 10000 + pawn_value + 20;
-        } else if (to_pt) {
-            int capture_value = eval::MATERIAL[*to_pt][MIDGAME] - eval::MATERIAL[from_pt][MIDGAME];
-            if (capture_value >= equality_bound) {
-                return 10000 + capture_value;
-            } else {
-                return 5000 + capture_value;
-            }
-        // Killer moves removed for compatibility with minimal SearchStack
-        } else {
-            return 0;
-        }
-    });
-}
-
 int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg) {
     if (sg.stop()) {
         return 0;
@@ -57,34 +35,54 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         return evaluate(pos);
     }
 
-    int eval = evaluate(pos);
-    if (eval > alpha) {
-        alpha = eval;
-    }
-    if (eval >= beta) {
-        return beta;
-    }
+    ss->refresh_accumulator(pos);
 
-    MoveList move_list;
-    if (pos.in_check()) {
-        move_list = pos.check_evasion_move_list();
+    bool pv_node = alpha != beta - 1;
 
-        if (move_list.empty()) {
-            return pos.in_check() ? -MATE_SCORE + ss->ply : 0;
+    auto hash = pos.hash();
+    TTEntry tt_entry = tt.probe(hash);
+    Move tt_move{0};
+    if (tt_entry.get_key() == hash) {
+        tt_move = Move{tt_entry.get_move()};
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
+        int tt_flag = tt_entry.get_flag();
+        if (!pv_node && (tt_flag == TTConstants::FLAG_EXACT ||
+                         (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
+                         (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha))) {
+            return tt_score;
         }
-    } else {
-        pos.generate_capture_moves(move_list, pos.side_to_move());
-        pos.generate_promotions(move_list, pos.side_to_move());
     }
 
-    sort_moves(pos, move_list, ss);
+    int old_alpha = alpha;
+
+    // In check only evasions are generated and standing pat is not an option, so every evasion is
+    // searched from -INFINITE and a position without one is mate
+    bool in_check = pos.in_check();
+    ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    int eval = ss->static_eval;
+    if (!in_check) {
+        if (eval > alpha) {
+            alpha = eval;
+        }
+        if (eval >= beta) {
+            return beta;
+        }
+    }
+    auto picker = MovePicker::new_qsearch_picker(pos, tt_move);
 
     int best_score = -INFINITE;
-    for (auto move : move_list) {
-        if (!pos.is_legal_generated_move(move)) {
-            continue;
+    std::optional<Move> best_move;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
+        if (!in_check) {
+            // Skip captures that lose material, and those that cannot lift the score to alpha
+            // even with a safety margin on top of what SEE says they win
+            int gain = see(pos, move);
+            if (gain < 0 || eval + gain + DELTA_MARGIN <= alpha) {
+                continue;
+            }
         }
-        pos.make_move(move);
+        ss->make_move(pos, move, *(ss + 1));
         int score = -qsearch_impl(pos, -beta, -alpha, ss + 1, sg);
         pos.unmake_move();
 
@@ -96,6 +94,7 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
             best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
                 if (alpha >= beta) {
                     break;
                 }
@@ -103,32 +102,45 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         }
     }
 
+    // Only evasions are generated in check, so no legal move there means mate
+    if (best_score == -INFINITE && in_check) {
+        return -MATE_SCORE + ss->ply;
+    }
+
+    int tt_flag = alpha >= beta       ? TTConstants::FLAG_LOWER
+                  : alpha > old_alpha ? TTConstants::FLAG_EXACT
+                                      : TTConstants::FLAG_UPPER;
+    tt.write(best_move ? best_move->value() : 0, tt_flag, TTConstants::DEPTH_QSEARCH,
+             score_to_tt(alpha, ss->ply), hash);
+
     return alpha;
 }
 
-SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
-                         SearchGlobals& sg) {
+int search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
+                SearchGlobals& sg) {
+    ss->clear_pv();
+
     if (depth <= 0) {
-        return {qsearch_impl(pos, alpha, beta, ss, sg), {}};
+        return qsearch_impl(pos, alpha, beta, ss, sg);
     }
 
     if (ss->ply) {
         if (sg.stop()) {
-            return {0, {}};
+            return 0;
         }
 
         if (pos.halfmoves() >= 100 || pos.is_repeat()) {
-            return {0, {}};
+            return 0;
         }
 
         if (ss->ply >= MAX_PLY) {
-            return {evaluate(pos), {}};
+            return evaluate(pos);
         }
 
         alpha = std::max((-MATE_SCORE + ss->ply), alpha);
         beta = std::min((MATE_SCORE - ss->ply), beta);
         if (alpha >= beta) {
-            return {alpha, {}};
+            return alpha;
         }
     }
 
@@ -139,81 +151,106 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
     Move tt_move{0};
     if (tt_entry.get_key() == hash) {
         tt_move = Move{tt_entry.get_move()};
-        int tt_score = tt_entry.get_score();
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
         int tt_flag = tt_entry.get_flag();
         if (!pv_node && tt_entry.get_depth() >= depth) {
             if (tt_flag == TTConstants::FLAG_EXACT ||
                 (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
                 (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha)) {
-                return {tt_score, {}};
+                return tt_score;
             }
         }
     }
 
-    if (!pv_node &&
-        (pos.occupancy_bb() &
-         ~(pos.piece_type_bb(constants::KING) | pos.piece_type_bb(constants::PAWN))) &&
-        !pos.in_check() && pos.previous_move() && beta > -MAX_MATE_SCORE) {
-        int static_eval = evaluate(pos);
-        if (depth < 3 && static_eval - 150 * depth >= beta) {
-            return {static_eval, {}};
-        }
+    ss->refresh_accumulator(pos);
+
+    bool in_check = pos.in_check();
+    // A null move verification search revisits this node and keeps the eval of the first visit
+    if (!ss->skip_null_move) {
+        ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    }
+    bool improving = ss->improving();
+    if (reverse_futility_prune(pos, ss, beta, depth, pv_node, in_check)) {
+        return ss->static_eval;
+    }
+    auto null_search = [&](int alpha_, int beta_, int depth_, SearchStack* ss_) {
+        return search_impl(pos, alpha_, beta_, depth_, ss_, sg);
+    };
+    if (auto score = null_move_cutoff(pos, beta, depth, pv_node, in_check, ss, null_search)) {
+        return *score;
     }
 
     sg.increment_nodes();
 
-    MoveList pv;
+    int old_alpha = alpha;
     int best_score = -INFINITE;
-    auto move_list = pos.legal_move_list();
-
-    if (move_list.empty()) {
-        return {pos.in_check() ? -MATE_SCORE + ss->ply : 0, {}};
-    }
-
-    sort_moves(pos, move_list, ss, tt_move);
+    std::optional<Move> best_move;
+    MoveHistory& history = thread_history();
+    auto picker = MovePicker::new_main_picker(pos, tt_move, ss->killers, history);
 
     int move_num = 0;
-    for (auto move : move_list) {
+    int quiet_count = 0;
+    std::array<Move, 64> quiets_searched;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
         ++move_num;
 
-        pos.make_move(move);
-        SearchResult search_result =
-            move_num == 1 ? -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg)
-                          : -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
-        if (move_num > 1 && search_result.score > alpha) {
-            search_result = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+        ss->make_move(pos, move, *(ss + 1));
+        int score;
+        if (move_num == 1) {
+            score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+        } else {
+            int reduction = late_move_reduction(move, depth, move_num, pv_node, improving,
+                                                in_check, pos.in_check());
+            score = -search_impl(pos, -alpha - 1, -alpha, depth - 1 - reduction, ss + 1, sg);
+            if (reduction && score > alpha) {
+                score = -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
+            }
+            if (score > alpha && score < beta) {
+                score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+            }
         }
         pos.unmake_move();
 
         if (ss->ply && sg.stop()) {
-            return {0, {}};
+            return 0;
+        }
+
+        if (!is_noisy(move) && quiet_count < int(quiets_searched.size())) {
+            quiets_searched[quiet_count++] = move;
         }
 
-        if (search_result.score > best_score) {
-            best_score = search_result.score;
+        if (score > best_score) {
+            best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
 
                 if (pv_node) {
-                    pv.clear();
-                    pv.add(move);
-                    if (search_result.pv) {
-                        pv.add(*search_result.pv);
-                    }
+                    ss->update_pv(move, *(ss + 1));
                 }
 
                 if (alpha >= beta) {
-                    // Killer move assignment removed for compatibility
+                    if (!is_noisy(move)) {
+                        ss->update_killers(move);
+                        history.update(pos, move, quiets_searched.data(), quiet_count, depth);
+                    }
                     break;
                 }
             }
         }
     }
 
-    int tt_flag = best_score >= beta ? TTConstants::FLAG_LOWER
-                                     : best_score < alpha ? TTConstants::FLAG_UPPER : FLAG_EXACT;
-    tt.write(pv.begin()->value(), tt_flag, depth, best_score, hash);
-    return {best_score, pv};
+    if (!move_num) {
+        return in_check ? -MATE_SCORE + ss->ply : 0;
+    }
+
+    int tt_flag = best_score >= beta       ? TTConstants::FLAG_LOWER
+                  : best_score > old_alpha ? TTConstants::FLAG_EXACT
+                                           : TTConstants::FLAG_UPPER;
+    tt.write(best_move ? best_move->value() : 0, tt_flag, depth,
+             score_to_tt(best_score, ss->ply), hash);
+    return best_score;
 }
 
 int qsearch(Position& pos) {
@@ -226,8 +263,8 @@ SearchResult search(Position& pos, SearchGlobals& sg, int depth) {
     auto search_stack = SearchStack::new_search_stack();
     int alpha = -INFINITE;
     int beta = +INFINITE;
-    SearchResult search_result = search_impl(pos, alpha, beta, depth, search_stack.begin(), sg);
-    return search_result;
+    int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), sg);
+    return {score, search_stack[0].pv_move_list()};
 }
 
 SearchResult search(Position& pos, int depth) {
@@ -236,23 +273,28 @@ SearchResult search(Position& pos, int depth) {
     auto search_globals = SearchGlobals::new_search_globals();
     int alpha = -INFINITE;
     int beta = +INFINITE;
-    SearchResult search_result =
-        search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
-    return search_result;
+    int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
+    return {score, search_stack[0].pv_move_list()};
 }
 
 std::optional<libchess::Move> best_move_search(libchess::Position& pos, SearchGlobals& search_globals, int max_depth) {
     std::optional<libchess::Move> best_move;
-    tt.clear();  // Clear transposition table to avoid stale entries
+    tt.new_search();  // Clear stale entries unless a warm table was loaded
+    new_search_history();
     auto start_time = curr_time();
     search_globals.set_stop_flag(false);
     search_globals.set_side_to_move(pos.side_to_move());
     search_globals.reset_nodes();
     search_globals.set_start_time(start_time);
     auto search_stack = SearchStack::new_search_stack();
-    
+
+    int score = 0;
     for (int depth = 1; depth <= max_depth; ++depth) {
-        auto search_result = search_impl(pos, -INFINITE, +INFINITE, depth, search_stack.begin(), search_globals);
+        auto window = AspirationWindow::new_aspiration_window(depth, score);
+        do {
+            score = search_impl(pos, window.alpha, window.beta, depth, search_stack.begin(),
+                                search_globals);
+        } while (!search_globals.stop() && window.widen(score));
 
         if (depth > 1 && search_globals.stop()) {
             return best_move;
@@ -260,14 +302,13 @@ std::optional<libchess::Move> best_move_search(libchess::Position& pos, SearchGl
 
         auto time_diff = curr_time() - start_time;
 
-        int score = search_result.score;
-        auto& pv = search_result.pv;
-        // if (!pv) {
+        auto pv = search_stack[0].pv_move_list();
+        // if (pv.empty()) {
         //     break;
         // }
 
-        if (pv && !pv->empty()) {
-            best_move = *pv->begin();
+        if (!pv.empty()) {
+            best_move = *pv.begin();
         }
 
         UCIScore uci_score = [score]() {
@@ -292,8 +333,8 @@ std::optional<libchess::Move> best_move_search(libchess::Position& pos, SearchGl
         }};
 
         std::vector<std::string> str_move_list;
-        str_move_list.reserve(pv->size());
-        for (auto move : *pv) {
+        str_move_list.reserve(pv.size());
+        for (auto move : pv) {
             str_move_list.push_back(move.to_str());
         }
         info_parameters.set_pv(UCIMoveList{str_move_list});
@@ -0,0 +1,25 @@
+#ifndef LIBCHESSENGINE__PARALLEL_H
+#define LIBCHESSENGINE__PARALLEL_H
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+// Runs worker on the calling thread and threads - 1 helpers and waits for all of them. Workers
+// share out the work themselves, usually by claiming block indices from an atomic counter.
+inline void run_on_threads(int threads, const std::function<void()>& worker) {
+    std::vector<std::thread> helpers;
+    for (int i = 1; i < threads; ++i) {
+        helpers.emplace_back(worker);
+    }
+    worker();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+} // namespace parallel
+
+#endif // LIBCHESSENGINE__PARALLEL_H
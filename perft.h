@@ -0,0 +1,156 @@
+#ifndef LIBCHESSENGINE__PERFT_H
+#define LIBCHESSENGINE__PERFT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "libchess/Position.h"
+#include "parallel.h"
+
+namespace perft {
+
+// Like the transposition table, an entry keeps its key xored with its data, so an entry torn by
+// another thread's write fails the key check instead of returning a wrong count
+struct PerftEntry {
+    std::uint64_t key;
+    // Depth in the top byte, leaf count below it
+    std::uint64_t data;
+};
+
+class PerftTable {
+  public:
+    // An empty table when MB is 0, which disables hashing
+    static PerftTable new_perft_table(int MB) {
+        std::size_t count = MB > 0 ? (std::size_t(MB) << 20) / sizeof(PerftEntry) : 0;
+        while (count & (count - 1)) {
+            count &= count - 1;
+        }
+        return PerftTable{count};
+    }
+
+    [[nodiscard]] bool enabled() const noexcept { return !entries_.empty(); }
+
+    [[nodiscard]] std::optional<std::uint64_t> probe(std::uint64_t key, int depth) const {
+        const auto& entry = entries_[key & mask_];
+        if ((entry.key ^ entry.data) != key || int(entry.data >> DEPTH_SHIFT) != depth) {
+            return {};
+        }
+        return entry.data & NODES_MASK;
+    }
+
+    void write(std::uint64_t key, int depth, std::uint64_t nodes) {
+        auto& entry = entries_[key & mask_];
+        entry.data = (std::uint64_t(depth) << DEPTH_SHIFT) | (nodes & NODES_MASK);
+        entry.key = key ^ entry.data;
+    }
+
+  private:
+    static const int DEPTH_SHIFT = 56;
+    static const std::uint64_t NODES_MASK = (std::uint64_t(1) << DEPTH_SHIFT) - 1;
+
+    explicit PerftTable(std::size_t count) : entries_(count), mask_(count ? count - 1 : 0) {}
+
+    std::vector<PerftEntry> entries_;
+    std::uint64_t mask_;
+};
+
+// Leaf nodes depth plies below pos. The last ply is bulk counted: the legal moves of a node one
+// ply above the leaves are counted without being played.
+inline std::uint64_t perft(libchess::Position& pos, int depth, PerftTable& table) {
+    if (depth == 0) {
+        return 1;
+    }
+    auto hash = pos.hash();
+    if (depth > 1 && table.enabled()) {
+        if (auto nodes = table.probe(hash, depth)) {
+            return *nodes;
+        }
+    }
+
+    auto moves = pos.legal_move_list();
+    if (depth == 1) {
+        return moves.size();
+    }
+    std::uint64_t nodes = 0;
+    for (auto move : moves) {
+        pos.make_move(move);
+        nodes += perft(pos, depth - 1, table);
+        pos.unmake_move();
+    }
+    if (table.enabled()) {
+        table.write(hash, depth, nodes);
+    }
+    return nodes;
+}
+
+struct DivideResult {
+    // Leaf nodes below each root move, in move generation order
+    std::vector<std::pair<libchess::Move, std::uint64_t>> moves;
+    std::uint64_t nodes;
+    std::uint64_t milliseconds;
+};
+
+// Perft split at the root: threads claim root moves one at a time, each on its own copy of the
+// position, and share one hash table
+inline DivideResult divide(const libchess::Position& pos, int depth, int threads, int hash_mb) {
+    auto start_time = std::chrono::steady_clock::now();
+    auto table = PerftTable::new_perft_table(hash_mb);
+    DivideResult result{{}, 0, 0};
+    for (auto move : pos.legal_move_list()) {
+        result.moves.push_back({move, 0});
+    }
+
+    std::atomic<std::size_t> next_move{0};
+    parallel::run_on_threads(threads, [&]() {
+        libchess::Position thread_pos = pos;
+        for (std::size_t i; (i = next_move.fetch_add(1)) < result.moves.size();) {
+            auto& [move, nodes] = result.moves[i];
+            thread_pos.make_move(move);
+            nodes = perft(thread_pos, depth - 1, table);
+            thread_pos.unmake_move();
+        }
+    });
+
+    for (auto& root_move : result.moves) {
+        result.nodes += root_move.second;
+    }
+    result.milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start_time)
+                              .count();
+    return result;
+}
+
+} // namespace perft
+
+// perft <depth> [threads] [hash MB], or divide with the same arguments to also list the count
+// below every root move
+inline void perft_handler(const libchess::Position& pos, std::istringstream& line_stream,
+                          bool show_moves) {
+    int depth = 1;
+    int threads = 1;
+    int hash_mb = 0;
+    line_stream >> depth >> threads >> hash_mb;
+    depth = std::max(1, depth);
+    threads = std::max(1, threads);
+
+    auto result = perft::divide(pos, depth, threads, hash_mb);
+    if (show_moves) {
+        for (auto& [move, nodes] : result.moves) {
+            std::cout << move.to_str() << ": " << nodes << "\n";
+        }
+        std::cout << "\n";
+    }
+    std::uint64_t nps = result.milliseconds ? result.nodes * 1000 / result.milliseconds : 0;
+    std::cout << "Nodes searched: " << result.nodes << "\n"
+              << "Time (ms): " << result.milliseconds << "\n"
+              << "Nodes/second: " << nps << "\n";
+}
+
+#endif // LIBCHESSENGINE__PERFT_H
@@ -0,0 +1,116 @@
+#ifndef PRUNING_H
+#define PRUNING_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <optional>
+
+#include "libchess/Position.h"
+#include "movepick.h"
+#include "search.h"
+
+namespace search {
+
+// Selectivity shared by every search variant. Each technique can be switched off on its own so
+// that the variants can be compared with exactly the same pruning, or with none at all.
+struct PruningOptions {
+    bool null_move = true;
+    bool late_move_reductions = true;
+    bool reverse_futility = true;
+};
+
+inline PruningOptions pruning_options;
+
+static const int NULL_MOVE_MIN_DEPTH = 3;
+// From this depth on a null move cutoff is only trusted once a reduced search agrees
+static const int NULL_MOVE_VERIFICATION_DEPTH = 8;
+
+static const int LMR_MIN_DEPTH = 3;
+static const int LMR_MIN_MOVES = 4;
+
+static const int RFP_MAX_DEPTH = 3;
+static const int RFP_MARGIN = 150;
+
+inline const std::array<std::array<int, 64>, 64> LMR_TABLE = []() {
+    std::array<std::array<int, 64>, 64> table{};
+    for (int depth = 1; depth < 64; ++depth) {
+        for (int move_num = 1; move_num < 64; ++move_num) {
+            table[depth][move_num] = int(0.75 + std::log(depth) * std::log(move_num) / 2.25);
+        }
+    }
+    return table;
+}();
+
+inline bool has_non_pawn_material(const libchess::Position& pos) {
+    using namespace libchess;
+    return bool(pos.color_bb(pos.side_to_move()) & ~(pos.piece_type_bb(constants::PAWN) |
+                                                      pos.piece_type_bb(constants::KING)));
+}
+
+inline bool after_null_move(const libchess::Position& pos) {
+    auto previous_move = pos.previous_move();
+    return !previous_move || !previous_move->value();
+}
+
+// Reverse futility pruning: close to the horizon a static eval that beats beta by a depth
+// dependent margin is returned as a fail high without searching any move. The margin is a ply
+// smaller when the eval has been rising.
+inline bool reverse_futility_prune(const libchess::Position& pos, const SearchStack* ss, int beta,
+                                   int depth, bool pv_node, bool in_check) {
+    return pruning_options.reverse_futility && !pv_node && !in_check && depth < RFP_MAX_DEPTH &&
+           beta > -MAX_MATE_SCORE && has_non_pawn_material(pos) && !after_null_move(pos) &&
+           ss->static_eval - RFP_MARGIN * (depth - ss->improving()) >= beta;
+}
+
+// Null move pruning: hand the opponent a free move and search the result with reduced depth.
+// If that still fails high the node is almost certainly a cut node. The caller supplies its own
+// search_impl as search(alpha, beta, depth, ss). Returns the score to fail high with, if any.
+template <class SearchFunction>
+std::optional<int> null_move_cutoff(libchess::Position& pos, int beta, int depth, bool pv_node,
+                                    bool in_check, SearchStack* ss, SearchFunction&& search) {
+    if (!pruning_options.null_move || pv_node || in_check || ss->skip_null_move ||
+        depth < NULL_MOVE_MIN_DEPTH || ss->static_eval < beta || beta >= MAX_MATE_SCORE ||
+        !has_non_pawn_material(pos) || after_null_move(pos)) {
+        return {};
+    }
+
+    int reduction = 3 + depth / 6;
+    ss->make_null_move(pos, *(ss + 1));
+    int score = -search(-beta, -beta + 1, std::max(0, depth - reduction - 1), ss + 1);
+    pos.unmake_move();
+    if (score < beta) {
+        return {};
+    }
+    // A mate found after passing is not a mate in the real position
+    score = std::min(score, MAX_MATE_SCORE - 1);
+    if (depth < NULL_MOVE_VERIFICATION_DEPTH) {
+        return score;
+    }
+
+    // Zugzwang guard: search the real moves at reduced depth without another null move here
+    ss->skip_null_move = true;
+    int verification = search(beta - 1, beta, depth - reduction, ss);
+    ss->skip_null_move = false;
+    if (verification < beta) {
+        return {};
+    }
+    return score;
+}
+
+// Depth reduction for a move searched late in the list; zero when the move must be searched to
+// full depth. Reduced moves that beat alpha are re-searched at full depth by the caller.
+inline int late_move_reduction(libchess::Move move, int depth, int move_num, bool pv_node,
+                               bool improving, bool in_check, bool gives_check) {
+    if (!pruning_options.late_move_reductions || depth < LMR_MIN_DEPTH ||
+        move_num < LMR_MIN_MOVES || in_check || gives_check || is_noisy(move)) {
+        return 0;
+    }
+    int reduction =
+        LMR_TABLE[std::min(depth, 63)][std::min(move_num, 63)] - int(pv_node) + int(!improving);
+    return std::clamp(reduction, 0, depth - 2);
+}
+
+} // namespace search
+
+#endif // PRUNING_H
@@ -5,7 +5,10 @@
 #include <algorithm>
 
 #include "evaluation.h"
+#include "movepick.h"
+#include "pruning.h"
 #include "search.h"
+#include "see.h"
 #include "tt.h" // Use the existing transposition table
 
 using namespace libchess;
@@ -14,40 +17,16 @@ using namespace eval;
 namespace search {
 
 // SearchStack implementation
-std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
-    std::array<SearchStack, MAX_PLY> search_stack{};
+std::array<SearchStack, SEARCH_STACK_SIZE> SearchStack::new_search_stack() noexcept {
+    std::array<SearchStack, SEARCH_STACK_SIZE> search_stack{};
     for (unsigned i = 0; i < search_stack.size(); ++i) {
         auto& ss = search_stack[i];
         ss.ply = int(i);
+        ss.static_eval = NO_STATIC_EVAL;
     }
     return search_stack;
 }
 
-void sort_moves(const Position& pos, MoveList& move_list, SearchStack* ss,
-                std::optional<Move> tt_move = {}) {
-    move_list.sort([&](Move move) {
-        auto from_pt = *pos.piece_type_on(move.from_square());
-        auto to_pt = pos.piece_type_on(move.to_square());
-
-        int pawn_value = eval::MATERIAL[constants::PAWN][MIDGAME];
-        int equality_bound = pawn_value - 50;
-        if (tt_move && move == *tt_move) {
-            return 20000;
-        } else if (move.type() == Move::Type::ENPASSANT) {
-            return 10000 + pawn_value + 20;
-        } else if (to_pt) {
-            int capture_value = eval::MATERIAL[*to_pt][MIDGAME] - eval::MATERIAL[from_pt][MIDGAME];
-            if (capture_value >= equality_bound) {
-                return 10000 + capture_value;
-            } else {
-                return 5000 + capture_value;
-            }
-        } else {
-            return 0;
-        }
-    });
-}
-
 int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg) {
     if (sg.stop()) {
         return 0;
@@ -59,34 +38,54 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         return evaluate(pos);
     }
 
-    int eval = evaluate(pos);
-    if (eval > alpha) {
-        alpha = eval;
-    }
-    if (eval >= beta) {
-        return beta;
-    }
+    ss->refresh_accumulator(pos);
 
-    MoveList move_list;
-    if (pos.in_check()) {
-        move_list = pos.check_evasion_move_list();
+    bool pv_node = alpha != beta - 1;
 
-        if (move_list.empty()) {
-            return pos.in_check() ? -MATE_SCORE + ss->ply : 0;
+    auto hash = pos.hash();
+    TTEntry tt_entry = tt.probe(hash);
+    Move tt_move{0};
+    if (tt_entry.get_key() == hash) {
+        tt_move = Move{tt_entry.get_move()};
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
+        int tt_flag = tt_entry.get_flag();
+        if (!pv_node && (tt_flag == TTConstants::FLAG_EXACT ||
+                         (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
+                         (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha))) {
+            return tt_score;
         }
-    } else {
-        pos.generate_capture_moves(move_list, pos.side_to_move());
-        pos.generate_promotions(move_list, pos.side_to_move());
     }
 
-    sort_moves(pos, move_list, ss);
+    int old_alpha = alpha;
+
+    // In check only evasions are generated and standing pat is not an option, so every evasion is
+    // searched from -INFINITE and a position without one is mate
+    bool in_check = pos.in_check();
+    ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    int eval = ss->static_eval;
+    if (!in_check) {
+        if (eval > alpha) {
+            alpha = eval;
+        }
+        if (eval >= beta) {
+            return beta;
+        }
+    }
+    auto picker = MovePicker::new_qsearch_picker(pos, tt_move);
 
     int best_score = -INFINITE;
-    for (auto move : move_list) {
-        if (!pos.is_legal_generated_move(move)) {
-            continue;
+    std::optional<Move> best_move;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
+        if (!in_check) {
+            // Skip captures that lose material, and those that cannot lift the score to alpha
+            // even with a safety margin on top of what SEE says they win
+            int gain = see(pos, move);
+            if (gain < 0 || eval + gain + DELTA_MARGIN <= alpha) {
+                continue;
+            }
         }
-        pos.make_move(move);
+        ss->make_move(pos, move, *(ss + 1));
         int score = -qsearch_impl(pos, -beta, -alpha, ss + 1, sg);
         pos.unmake_move();
 
@@ -98,6 +97,7 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
             best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
                 if (alpha >= beta) {
                     break;
                 }
@@ -105,32 +105,45 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         }
     }
 
+    // Only evasions are generated in check, so no legal move there means mate
+    if (best_score == -INFINITE && in_check) {
+        return -MATE_SCORE + ss->ply;
+    }
+
+    int tt_flag = alpha >= beta       ? TTConstants::FLAG_LOWER
+                  : alpha > old_alpha ? TTConstants::FLAG_EXACT
+                                      : TTConstants::FLAG_UPPER;
+    tt.write(best_move ? best_move->value() : 0, tt_flag, TTConstants::DEPTH_QSEARCH,
+             score_to_tt(alpha, ss->ply), hash);
+
     return alpha;
 }
 
-SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
-                         SearchGlobals& sg) {
+int search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
+                SearchGlobals& sg) {
+    ss->clear_pv();
+
     if (depth <= 0) {
-        return {qsearch_impl(pos, alpha, beta, ss, sg), {}};
+        return qsearch_impl(pos, alpha, beta, ss, sg);
     }
 
     if (ss->ply) {
         if (sg.stop()) {
-            return {0, {}};
+            return 0;
         }
 
         if (pos.halfmoves() >= 100 || pos.is_repeat()) {
-            return {0, {}};
+            return 0;
         }
 
         if (ss->ply >= MAX_PLY) {
-            return {evaluate(pos), {}};
+            return evaluate(pos);
         }
 
         alpha = std::max((-MATE_SCORE + ss->ply), alpha);
         beta = std::min((MATE_SCORE - ss->ply), beta);
         if (alpha >= beta) {
-            return {alpha, {}};
+            return alpha;
         }
     }
 
@@ -141,29 +154,53 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
     Move tt_move{0};
     if (tt_entry.get_key() == hash) {
         tt_move = Move{tt_entry.get_move()};
-        int tt_score = tt_entry.get_score();
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
         int tt_flag = tt_entry.get_flag();
         if (!pv_node && tt_entry.get_depth() >= depth) {
             if (tt_flag == TTConstants::FLAG_EXACT ||
                 (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
                 (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha)) {
-                return {tt_score, {}};
+                return tt_score;
             }
         }
     }
 
+    ss->refresh_accumulator(pos);
+
+    bool in_check = pos.in_check();
+    // A null move verification search revisits this node and keeps the eval of the first visit
+    if (!ss->skip_null_move) {
+        ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    }
+    bool improving = ss->improving();
+    if (reverse_futility_prune(pos, ss, beta, depth, pv_node, in_check)) {
+        return ss->static_eval;
+    }
+    auto null_search = [&](int alpha_, int beta_, int depth_, SearchStack* ss_) {
+        return search_impl(pos, alpha_, beta_, depth_, ss_, sg);
+    };
+    if (auto score = null_move_cutoff(pos, beta, depth, pv_node, in_check, ss, null_search)) {
+        return *score;
+    }
+
     sg.increment_nodes();
 
-    MoveList pv;
     int best_score = -INFINITE;
-    auto move_list = pos.legal_move_list();
+    MoveHistory& history = thread_history();
+    auto picker = MovePicker::new_main_picker(pos, tt_move, ss->killers, history);
 
-    if (move_list.empty()) {
-        return {pos.in_check() ? -MATE_SCORE + ss->ply : 0, {}};
+    // Splitting the root across threads needs all of its moves up front; everywhere else they
+    // are picked one at a time so that a cutoff skips the rest of the generation
+    MoveList move_list;
+    if (ss->ply == 0) {
+        while (auto move = picker.next_move()) {
+            move_list.add(*move);
+        }
+        if (move_list.empty()) {
+            return in_check ? -MATE_SCORE + ss->ply : 0;
+        }
     }
 
-    sort_moves(pos, move_list, ss, tt_move);
-
     // Hybrid parallelization: Use OpenMP for parallel move search within this process
     // but only at certain depths to avoid thread overhead
     bool use_openmp = (depth >= 3 && ss->ply == 0 && move_list.size() >= 4);
@@ -171,13 +208,10 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
     if (use_openmp) {
         // OpenMP parallel search for root or near-root nodes
         int shared_best_score = -INFINITE;
-        MoveList shared_pv;
         bool cutoff_found = false;
         
         #pragma omp parallel
         {
-            int local_best_score = -INFINITE;
-            MoveList local_pv;
             int local_alpha = alpha;
             
             #pragma omp for schedule(dynamic, 1) nowait
@@ -187,36 +221,32 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
                 auto move_it = std::next(move_list.begin(), i);
                 auto move = *move_it;
                 
-                Position thread_pos = pos;
-                thread_pos.make_move(move);
-                
                 // Create thread-local search stack and use shared globals
                 auto thread_stack = SearchStack::new_search_stack();
+
+                Position thread_pos = pos;
+                ss->make_move(thread_pos, move, thread_stack[1]);
                 
-                SearchResult search_result =
+                int score =
                     i == 0 ? -search_impl(thread_pos, -beta, -local_alpha, depth - 1, thread_stack.begin() + 1, sg)
                            : -search_impl(thread_pos, -local_alpha - 1, -local_alpha, depth - 1, thread_stack.begin() + 1, sg);
                 
-                if (i > 0 && search_result.score > local_alpha) {
-                    search_result = -search_impl(thread_pos, -beta, -local_alpha, depth - 1, thread_stack.begin() + 1, sg);
+                if (i > 0 && score > local_alpha) {
+                    score = -search_impl(thread_pos, -beta, -local_alpha, depth - 1, thread_stack.begin() + 1, sg);
                 }
                 
                 #pragma omp critical
                 {
                     // Node counting is handled automatically since we share sg
                     
-                    if (search_result.score > shared_best_score) {
-                        shared_best_score = search_result.score;
+                    if (score > shared_best_score) {
+                        shared_best_score = score;
                         if (shared_best_score > alpha) {
                             alpha = shared_best_score;
                             local_alpha = alpha; // Update local alpha for other threads
                             
                             if (pv_node) {
-                                shared_pv.clear();
-                                shared_pv.add(move);
-                                if (search_result.pv) {
-                                    shared_pv.add(*search_result.pv);
-                                }
+                                ss->update_pv(move, thread_stack[1]);
                             }
                             
                             if (alpha >= beta) {
@@ -229,53 +259,82 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
         }
         
         best_score = shared_best_score;
-        pv = shared_pv;
     } else {
         // Sequential search for deeper nodes or when OpenMP overhead isn't worth it
+        auto next_root_move = move_list.begin();
+        auto pick_move = [&]() -> std::optional<Move> {
+            if (ss->ply) {
+                return picker.next_move();
+            }
+            if (next_root_move == move_list.end()) {
+                return {};
+            }
+            return *next_root_move++;
+        };
+
         int move_num = 0;
-        for (auto move : move_list) {
+        int quiet_count = 0;
+        std::array<Move, 64> quiets_searched;
+        while (auto next_move = pick_move()) {
+            Move move = *next_move;
             ++move_num;
 
-            pos.make_move(move);
-            SearchResult search_result =
-                move_num == 1 ? -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg)
-                              : -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
-            if (move_num > 1 && search_result.score > alpha) {
-                search_result = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+            ss->make_move(pos, move, *(ss + 1));
+            int score;
+            if (move_num == 1) {
+                score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+            } else {
+                int reduction = late_move_reduction(move, depth, move_num, pv_node, improving,
+                                                    in_check, pos.in_check());
+                score = -search_impl(pos, -alpha - 1, -alpha, depth - 1 - reduction, ss + 1, sg);
+                if (reduction && score > alpha) {
+                    score = -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
+                }
+                if (score > alpha && score < beta) {
+                    score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+                }
             }
             pos.unmake_move();
 
             if (ss->ply && sg.stop()) {
-                return {0, {}};
+                return 0;
+            }
+
+            if (!is_noisy(move) && quiet_count < int(quiets_searched.size())) {
+                quiets_searched[quiet_count++] = move;
             }
 
-            if (search_result.score > best_score) {
-                best_score = search_result.score;
+            if (score > best_score) {
+                best_score = score;
                 if (best_score > alpha) {
                     alpha = best_score;
 
                     if (pv_node) {
-                        pv.clear();
-                        pv.add(move);
-                        if (search_result.pv) {
-                            pv.add(*search_result.pv);
-                        }
+                        ss->update_pv(move, *(ss + 1));
                     }
 
                     if (alpha >= beta) {
+                        if (!is_noisy(move)) {
+                            ss->update_killers(move);
+                            history.update(pos, move, quiets_searched.data(), quiet_count, depth);
+                        }
                         break;
                     }
                 }
             }
         }
+
+        if (!move_num) {
+            return in_check ? -MATE_SCORE + ss->ply : 0;
+        }
     }
 
     int tt_flag = best_score >= beta ? TTConstants::FLAG_LOWER
                                      : best_score < alpha ? TTConstants::FLAG_UPPER : TTConstants::FLAG_EXACT;
-    if (!pv.empty()) {
-        tt.write(pv.begin()->value(), tt_flag, depth, best_score, hash);
+    if (ss->pv_length > 0) {
+        tt.write(ss->pv[0].value(), tt_flag, depth, score_to_tt(best_score, ss->ply), hash);
     }
-    return {best_score, pv};
+    return best_score;
 }
 
 int qsearch(Position& pos) {
@@ -284,8 +343,11 @@ int qsearch(Position& pos) {
     return qsearch_impl(pos, -INFINITE, +INFINITE, search_stack.begin(), search_globals);
 }
 
-// MPI-based root splitting with OpenMP within each process
-SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
+// MPI-based root splitting with OpenMP within each process. Every worker searches its move
+// inside the master's window; a root score outside the window tells best_move_search to widen
+// it and search again
+SearchResult search_root(Position& pos, SearchGlobals& search_globals, int depth, int alpha,
+                         int beta) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -295,7 +357,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
     if (rank == 0) {
         // Master process
         MoveList moves = pos.legal_move_list();
-        sort_moves(pos, moves, search_stack.begin());
+        order_moves(pos, moves);
 
         if (moves.empty()) {
             SearchResult empty_result = {pos.in_check() ? -MATE_SCORE : 0, {}};
@@ -309,10 +371,12 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
 
         // If only one process, use hybrid search directly
         if (size == 1) {
-            return search_impl(pos, -INFINITE, +INFINITE, depth, search_stack.begin(), search_globals);
+            int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
+            return {score, search_stack[0].pv_move_list()};
         }
 
         SearchResult best_result = {-INFINITE, {}};
+        const std::array<int, 2> window{alpha, beta};
         std::vector<bool> worker_busy(size, false);
         std::vector<Move> worker_moves(size);
         
@@ -333,6 +397,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
                 MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 
                 worker_busy[worker] = true;
                 worker_moves[worker] = move;
@@ -370,8 +435,8 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
             worker_result.score = -result_score; // Negate because we're at root
             
             if (pv_length > 0) {
-                std::vector<uint16_t> pv_values(pv_length);
-                MPI_Recv(pv_values.data(), pv_length, MPI_UNSIGNED_SHORT, worker, 1, MPI_COMM_WORLD, &status);
+                std::vector<uint32_t> pv_values(pv_length);
+                MPI_Recv(pv_values.data(), pv_length, MPI_UINT32_T, worker, 1, MPI_COMM_WORLD, &status);
                 
                 MoveList pv;
                 pv.add(completed_move);
@@ -404,6 +469,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
                 MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 
                 worker_busy[worker] = true;
                 worker_moves[worker] = move;
@@ -421,6 +487,10 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
     }
 }
 
+SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
+    return search_root(pos, search_globals, depth, -INFINITE, +INFINITE);
+}
+
 SearchResult search(Position& pos, int depth) {
     auto search_globals = SearchGlobals::new_search_globals();
     return search(pos, search_globals, depth);
@@ -443,9 +513,18 @@ std::optional<Move> best_move_search(Position& pos, SearchGlobals& search_global
         
         // Clear transposition table for clean search
         tt.clear();
+        new_search_history();
         
+        int previous_score = 0;
         for (int depth = 1; depth <= max_depth; ++depth) {
-            auto search_result = search(pos, search_globals, depth);
+            auto window = AspirationWindow::new_aspiration_window(depth, previous_score);
+            auto search_result =
+                search_root(pos, search_globals, depth, window.alpha, window.beta);
+            while (!search_globals.stop() && window.widen(search_result.score)) {
+                search_result =
+                    search_root(pos, search_globals, depth, window.alpha, window.beta);
+            }
+            previous_score = search_result.score;
 
             if (depth > 1 && search_globals.stop()) {
                 return best_move;
@@ -534,28 +613,34 @@ void mpi_worker_loop() {
         int search_depth;
         MPI_Recv(&search_depth, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
 
+        // Receive the root window, which the worker sees from the other side
+        std::array<int, 2> window;
+        MPI_Recv(window.data(), 2, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
+
         // Create position and search using hybrid approach
         Position worker_pos(fen);
         
         uint64_t initial_nodes = search_globals.nodes();
-        auto result = search_impl(worker_pos, -INFINITE, INFINITE, search_depth - 1, 
+        int score = search_impl(worker_pos, -window[1], -window[0], search_depth - 1,
                                 search_stack.begin() + 1, search_globals);
         uint64_t nodes_searched = search_globals.nodes() - initial_nodes;
 
         // Send result back
-        MPI_Send(&result.score, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
+        MPI_Send(&score, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
         MPI_Send(&nodes_searched, 1, MPI_UNSIGNED_LONG_LONG, 0, 1, MPI_COMM_WORLD);
         
-        // Send PV
-        int pv_length = result.pv ? result.pv->size() : 0;
+        // Send PV, read straight out of the worker's PV table. Moves are sent whole since they
+        // do not fit in 16 bits
+        const SearchStack& worker_ss = search_stack[1];
+        int pv_length = worker_ss.pv_length;
         MPI_Send(&pv_length, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
-        
+
         if (pv_length > 0) {
-            std::vector<uint16_t> pv_values;
-            for (auto move : *result.pv) {
-                pv_values.push_back(move.value());
+            std::array<uint32_t, MAX_PLY> pv_values;
+            for (int i = 0; i < pv_length; ++i) {
+                pv_values[i] = worker_ss.pv[i].value();
             }
-            MPI_Send(pv_values.data(), pv_length, MPI_UNSIGNED_SHORT, 0, 1, MPI_COMM_WORLD);
+            MPI_Send(pv_values.data(), pv_length, MPI_UINT32_T, 0, 1, MPI_COMM_WORLD);
         }
     }
 }
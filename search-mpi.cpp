@@ -4,17 +4,23 @@
 #include <algorithm>
 
 #include "evaluation.h"
+#include "movepick.h"
+#include "pruning.h"
 #include "search.h"
+#include "see.h"
 
 using namespace libchess;
 using namespace eval;
 
 // Simple Transposition Table
+// Depth stored for quiescence search entries, which never displace main search entries
+static const int QSEARCH_DEPTH = 0;
+
 struct TTEntry {
     uint64_t hash;
     int depth;
     int score;
-    uint16_t best_move;
+    uint32_t best_move;
     enum Flag { EXACT, LOWER_BOUND, UPPER_BOUND } flag;
     
     TTEntry() : hash(0), depth(-1), score(0), best_move(0), flag(EXACT) {}
@@ -32,6 +38,10 @@ public:
         size_t index = hash % TABLE_SIZE;
         TTEntry& entry = table[index];
         
+        if (depth == QSEARCH_DEPTH && entry.hash != hash && entry.depth > QSEARCH_DEPTH) {
+            return;
+        }
+
         // Replace if deeper or same position
         if (entry.hash != hash || depth >= entry.depth) {
             entry.hash = hash;
@@ -59,11 +69,12 @@ TranspositionTable tt;
 namespace search {
 
 // SearchStack implementation
-std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
-    std::array<SearchStack, MAX_PLY> search_stack{};
+std::array<SearchStack, SEARCH_STACK_SIZE> SearchStack::new_search_stack() noexcept {
+    std::array<SearchStack, SEARCH_STACK_SIZE> search_stack{};
     for (unsigned i = 0; i < search_stack.size(); ++i) {
         auto& ss = search_stack[i];
         ss.ply = int(i);
+        ss.static_eval = NO_STATIC_EVAL;
     }
     return search_stack;
 }
@@ -83,31 +94,6 @@ struct MPIResult {
     std::vector<uint16_t> pv_moves;
 };
 
-void sort_moves(const Position& pos, MoveList& move_list, SearchStack* ss,
-                std::optional<Move> tt_move = {}) {
-    move_list.sort([&](Move move) {
-        auto from_pt = *pos.piece_type_on(move.from_square());
-        auto to_pt = pos.piece_type_on(move.to_square());
-
-        int pawn_value = eval::MATERIAL[constants::PAWN][MIDGAME];
-        int equality_bound = pawn_value - 50;
-        if (tt_move && move == *tt_move) {
-            return 20000;
-        } else if (move.type() == Move::Type::ENPASSANT) {
-            return 10000 + pawn_value + 20;
-        } else if (to_pt) {
-            int capture_value = eval::MATERIAL[*to_pt][MIDGAME] - eval::MATERIAL[from_pt][MIDGAME];
-            if (capture_value >= equality_bound) {
-                return 10000 + capture_value;
-            } else {
-                return 5000 + capture_value;
-            }
-        } else {
-            return 0;
-        }
-    });
-}
-
 int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg) {
     if (sg.stop()) {
         return 0;
@@ -119,34 +105,57 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         return evaluate(pos);
     }
 
-    int eval = evaluate(pos);
-    if (eval > alpha) {
-        alpha = eval;
-    }
-    if (eval >= beta) {
-        return beta;
-    }
+    ss->refresh_accumulator(pos);
+
+    bool pv_node = alpha != beta - 1;
+    uint64_t pos_hash = pos.hash();
 
-    MoveList move_list;
-    if (pos.in_check()) {
-        move_list = pos.check_evasion_move_list();
+    // Transposition Table probe; any entry is at least as deep as quiescence search
+    Move tt_move{0};
+    TTEntry* tt_entry = tt.probe(pos_hash);
+    if (tt_entry) {
+        int tt_score = score_from_tt(tt_entry->score, ss->ply);
 
-        if (move_list.empty()) {
-            return pos.in_check() ? -MATE_SCORE + ss->ply : 0;
+        if (!pv_node && ((tt_entry->flag == TTEntry::EXACT) ||
+                         (tt_entry->flag == TTEntry::LOWER_BOUND && tt_score >= beta) ||
+                         (tt_entry->flag == TTEntry::UPPER_BOUND && tt_score <= alpha))) {
+            return tt_score;
+        }
+        if (tt_entry->best_move != 0) {
+            tt_move = Move(tt_entry->best_move);
         }
-    } else {
-        pos.generate_capture_moves(move_list, pos.side_to_move());
-        pos.generate_promotions(move_list, pos.side_to_move());
     }
 
-    sort_moves(pos, move_list, ss);
+    int old_alpha = alpha;
+
+    // In check only evasions are generated and standing pat is not an option, so every evasion is
+    // searched from -INFINITE and a position without one is mate
+    bool in_check = pos.in_check();
+    ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    int eval = ss->static_eval;
+    if (!in_check) {
+        if (eval > alpha) {
+            alpha = eval;
+        }
+        if (eval >= beta) {
+            return beta;
+        }
+    }
+    auto picker = MovePicker::new_qsearch_picker(pos, tt_move);
 
     int best_score = -INFINITE;
-    for (auto move : move_list) {
-        if (!pos.is_legal_generated_move(move)) {
-            continue;
+    Move best_move;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
+        if (!in_check) {
+            // Skip captures that lose material, and those that cannot lift the score to alpha
+            // even with a safety margin on top of what SEE says they win
+            int gain = see(pos, move);
+            if (gain < 0 || eval + gain + DELTA_MARGIN <= alpha) {
+                continue;
+            }
         }
-        pos.make_move(move);
+        ss->make_move(pos, move, *(ss + 1));
         int score = -qsearch_impl(pos, -beta, -alpha, ss + 1, sg);
         pos.unmake_move();
 
@@ -158,6 +167,7 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
             best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
                 if (alpha >= beta) {
                     break;
                 }
@@ -165,32 +175,43 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         }
     }
 
+    // Only evasions are generated in check, so no legal move there means mate
+    if (best_score == -INFINITE && in_check) {
+        return -MATE_SCORE + ss->ply;
+    }
+
+    TTEntry::Flag flag = alpha >= beta       ? TTEntry::LOWER_BOUND
+                         : alpha > old_alpha ? TTEntry::EXACT
+                                             : TTEntry::UPPER_BOUND;
+    tt.store(pos_hash, QSEARCH_DEPTH, score_to_tt(alpha, ss->ply), best_move, flag);
+
     return alpha;
 }
 
-SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
-                         SearchGlobals& sg) {
+int search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss, SearchGlobals& sg) {
+    ss->clear_pv();
+
     if (depth <= 0) {
-        return {qsearch_impl(pos, alpha, beta, ss, sg), {}};
+        return qsearch_impl(pos, alpha, beta, ss, sg);
     }
 
     if (ss->ply) {
         if (sg.stop()) {
-            return {0, {}};
+            return 0;
         }
 
         if (pos.halfmoves() >= 100 || pos.is_repeat()) {
-            return {0, {}};
+            return 0;
         }
 
         if (ss->ply >= MAX_PLY) {
-            return {evaluate(pos), {}};
+            return evaluate(pos);
         }
 
         alpha = std::max((-MATE_SCORE + ss->ply), alpha);
         beta = std::min((MATE_SCORE - ss->ply), beta);
         if (alpha >= beta) {
-            return {alpha, {}};
+            return alpha;
         }
     }
 
@@ -198,27 +219,20 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
     uint64_t pos_hash = pos.hash();
     
     // Transposition Table probe
-    Move tt_move;
+    Move tt_move{0};
     TTEntry* tt_entry = tt.probe(pos_hash);
     if (tt_entry && tt_entry->depth >= depth) {
-        int tt_score = tt_entry->score;
-        
-        // Adjust mate scores
-        if (tt_score >= MAX_MATE_SCORE) {
-            tt_score -= ss->ply;
-        } else if (tt_score <= -MAX_MATE_SCORE) {
-            tt_score += ss->ply;
-        }
+        int tt_score = score_from_tt(tt_entry->score, ss->ply);
         
         if ((tt_entry->flag == TTEntry::EXACT) ||
             (tt_entry->flag == TTEntry::LOWER_BOUND && tt_score >= beta) ||
             (tt_entry->flag == TTEntry::UPPER_BOUND && tt_score <= alpha)) {
             
-            MoveList pv;
             if (tt_entry->best_move != 0) {
-                pv.add(Move(tt_entry->best_move));
+                ss->pv[0] = Move(tt_entry->best_move);
+                ss->pv_length = 1;
             }
-            return {tt_score, pv};
+            return tt_score;
         }
     }
     
@@ -226,88 +240,81 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
         tt_move = Move(tt_entry->best_move);
     }
 
-    sg.increment_nodes();
-
-    MoveList pv;
-    int best_score = -INFINITE;
-    auto move_list = pos.legal_move_list();
+    ss->refresh_accumulator(pos);
 
-    if (move_list.empty()) {
-        return {pos.in_check() ? -MATE_SCORE + ss->ply : 0, {}};
+    bool in_check = pos.in_check();
+    // A null move verification search revisits this node and keeps the eval of the first visit
+    if (!ss->skip_null_move) {
+        ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
     }
-
-    // Null Move Pruning - skip our turn to see if position is still good
-    if (!pv_node && !pos.in_check() && depth >= 3 && ss->ply > 0) {
-        int static_eval = evaluate(pos);
-        if (static_eval >= beta) {
-            // Make null move (skip turn)
-            pos.make_null_move();
-            int null_reduction = 3;
-            SearchResult null_result = -search_impl(pos, -beta, -beta + 1, depth - null_reduction - 1, ss + 1, sg);
-            pos.unmake_move();
-            
-            if (null_result.score >= beta) {
-                return {beta, {}};  // Null move cutoff
-            }
-        }
+    bool improving = ss->improving();
+    if (reverse_futility_prune(pos, ss, beta, depth, pv_node, in_check)) {
+        return ss->static_eval;
     }
+    auto null_search = [&](int alpha_, int beta_, int depth_, SearchStack* ss_) {
+        return search_impl(pos, alpha_, beta_, depth_, ss_, sg);
+    };
+    if (auto score = null_move_cutoff(pos, beta, depth, pv_node, in_check, ss, null_search)) {
+        return *score;
+    }
+
+    sg.increment_nodes();
+
+    int best_score = -INFINITE;
 
-    sort_moves(pos, move_list, ss, tt_move);
+    MoveHistory& history = thread_history();
+    auto picker = MovePicker::new_main_picker(pos, tt_move, ss->killers, history);
 
     int move_num = 0;
+    int quiet_count = 0;
+    std::array<Move, 64> quiets_searched;
     Move best_move;
 
-    for (auto move : move_list) {
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
         ++move_num;
-        
-        // Check if this move captures a piece (for LMR conditions)
-        auto to_pt = pos.piece_type_on(move.to_square());
 
-        pos.make_move(move);
-        
-        int new_depth = depth - 1;
-        
-        // Late Move Reductions (LMR) - reduce search depth for later moves
-        if (move_num > 3 && depth > 2 && !pos.in_check() && !to_pt && move.type() != Move::Type::PROMOTION) {
-            new_depth = std::max(1, depth - 2);
-        }
-        
-        SearchResult search_result =
-            move_num == 1 ? -search_impl(pos, -beta, -alpha, new_depth, ss + 1, sg)
-                          : -search_impl(pos, -alpha - 1, -alpha, new_depth, ss + 1, sg);
-        
-        // Re-search with full depth if LMR gave a good score
-        if (move_num > 1 && search_result.score > alpha) {
-            if (new_depth < depth - 1) {
-                // Re-search with full depth after LMR
-                search_result = -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
+        ss->make_move(pos, move, *(ss + 1));
+        int score;
+        if (move_num == 1) {
+            score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+        } else {
+            int reduction = late_move_reduction(move, depth, move_num, pv_node, improving,
+                                                in_check, pos.in_check());
+            score = -search_impl(pos, -alpha - 1, -alpha, depth - 1 - reduction, ss + 1, sg);
+            if (reduction && score > alpha) {
+                score = -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
             }
-            if (search_result.score > alpha) {
-                search_result = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+            if (score > alpha && score < beta) {
+                score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
             }
         }
         pos.unmake_move();
 
         if (ss->ply && sg.stop()) {
-            return {0, {}};
+            return 0;
+        }
+
+        if (!is_noisy(move) && quiet_count < int(quiets_searched.size())) {
+            quiets_searched[quiet_count++] = move;
         }
 
-        if (search_result.score > best_score) {
-            best_score = search_result.score;
+        if (score > best_score) {
+            best_score = score;
             best_move = move;
             
             if (best_score > alpha) {
                 alpha = best_score;
 
                 if (pv_node) {
-                    pv.clear();
-                    pv.add(move);
-                    if (search_result.pv) {
-                        pv.add(*search_result.pv);
-                    }
+                    ss->update_pv(move, *(ss + 1));
                 }
 
                 if (alpha >= beta) {
+                    if (!is_noisy(move)) {
+                        ss->update_killers(move);
+                        history.update(pos, move, quiets_searched.data(), quiet_count, depth);
+                    }
                     // Store beta cutoff in TT
                     tt.store(pos_hash, depth, best_score, best_move, TTEntry::LOWER_BOUND);
                     break;
@@ -315,21 +322,18 @@ SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchSt
             }
         }
     }
+
+    if (!move_num) {
+        return in_check ? -MATE_SCORE + ss->ply : 0;
+    }
     
     // Store result in transposition table
     TTEntry::Flag flag = (best_score <= alpha) ? TTEntry::UPPER_BOUND : TTEntry::EXACT;
     if (best_move.value() != 0) {  // Only store if we have a best move
-        int store_score = best_score;
-        // Adjust mate scores for storage
-        if (store_score >= MAX_MATE_SCORE) {
-            store_score += ss->ply;
-        } else if (store_score <= -MAX_MATE_SCORE) {
-            store_score -= ss->ply;
-        }
-        tt.store(pos_hash, depth, store_score, best_move, flag);
+        tt.store(pos_hash, depth, score_to_tt(best_score, ss->ply), best_move, flag);
     }
     
-    return {best_score, pv};
+    return best_score;
 }
 
 int qsearch(Position& pos) {
@@ -338,13 +342,10 @@ int qsearch(Position& pos) {
     return qsearch_impl(pos, -INFINITE, +INFINITE, search_stack.begin(), search_globals);
 }
 
-// MPI-based root splitting search
-SearchResult search(Position& pos, int depth) {
-    auto search_globals = SearchGlobals::new_search_globals();
-    return search(pos, search_globals, depth);
-}
-
-SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
+// MPI-based root splitting search. Every worker searches its move inside the master's window;
+// a root score outside the window tells best_move_search to widen it and search again
+SearchResult search_root(Position& pos, SearchGlobals& search_globals, int depth, int alpha,
+                         int beta) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -354,7 +355,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
     if (rank == 0) {
         // Master process
         MoveList moves = pos.legal_move_list();
-        sort_moves(pos, moves, search_stack.begin());
+        order_moves(pos, moves);
 
         if (moves.empty()) {
             SearchResult empty_result = {pos.in_check() ? -MATE_SCORE : 0, {}};
@@ -368,10 +369,12 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
 
         // If only one process, fall back to sequential search
         if (size == 1) {
-            return search_impl(pos, -INFINITE, +INFINITE, depth, search_stack.begin(), search_globals);
+            int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
+            return {score, search_stack[0].pv_move_list()};
         }
 
         SearchResult best_result = {-INFINITE, {}};
+        const std::array<int, 2> window{alpha, beta};
         std::vector<bool> worker_busy(size, false);
         std::vector<Move> worker_moves(size);
         
@@ -392,6 +395,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
                 MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 
                 worker_busy[worker] = true;
                 worker_moves[worker] = move;
@@ -431,8 +435,8 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
             
             if (pv_length > 0) {
                 // Receive PV moves
-                std::vector<uint16_t> pv_values(pv_length);
-                MPI_Recv(pv_values.data(), pv_length, MPI_UNSIGNED_SHORT, worker, 1, MPI_COMM_WORLD, &status);
+                std::vector<uint32_t> pv_values(pv_length);
+                MPI_Recv(pv_values.data(), pv_length, MPI_UINT32_T, worker, 1, MPI_COMM_WORLD, &status);
                 
                 // Convert to MoveList
                 MoveList pv;
@@ -466,6 +470,7 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
                 MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 
                 worker_busy[worker] = true;
                 worker_moves[worker] = move;
@@ -486,9 +491,19 @@ SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
     }
 }
 
+SearchResult search(Position& pos, SearchGlobals& search_globals, int depth) {
+    return search_root(pos, search_globals, depth, -INFINITE, +INFINITE);
+}
+
+SearchResult search(Position& pos, int depth) {
+    auto search_globals = SearchGlobals::new_search_globals();
+    return search(pos, search_globals, depth);
+}
+
 // Alternative implementation with non-blocking receives (more efficient)
 // This could replace the current implementation for better performance
-SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, int depth) {
+SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, int depth, int alpha,
+                                int beta) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
@@ -498,7 +513,7 @@ SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, in
     if (rank == 0) {
         // Master process with non-blocking receives
         MoveList moves = pos.legal_move_list();
-        sort_moves(pos, moves, search_stack.begin());
+        order_moves(pos, moves);
 
         if (moves.empty()) {
             SearchResult empty_result = {pos.in_check() ? -MATE_SCORE : 0, {}};
@@ -510,10 +525,12 @@ SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, in
         }
 
         if (size == 1) {
-            return search_impl(pos, -INFINITE, +INFINITE, depth, search_stack.begin(), search_globals);
+            int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
+            return {score, search_stack[0].pv_move_list()};
         }
 
         SearchResult best_result = {-INFINITE, {}};
+        const std::array<int, 2> window{alpha, beta};
         std::vector<MPI_Request> requests(size - 1);
         std::vector<int> worker_scores(size);
         std::vector<bool> worker_busy(size, false);
@@ -535,6 +552,7 @@ SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, in
                 MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                 MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                 
                 // Post non-blocking receive for result
                 MPI_Irecv(&worker_scores[worker], 1, MPI_INT, worker, 1, MPI_COMM_WORLD, &requests[worker - 1]);
@@ -574,6 +592,7 @@ SearchResult search_nonblocking(Position& pos, SearchGlobals& search_globals, in
                     MPI_Send(&fen_size, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
                     MPI_Send(fen.c_str(), fen_size, MPI_CHAR, worker, 0, MPI_COMM_WORLD);
                     MPI_Send(&depth, 1, MPI_INT, worker, 0, MPI_COMM_WORLD);
+                    MPI_Send(window.data(), 2, MPI_INT, worker, 0, MPI_COMM_WORLD);
                     
                     MPI_Irecv(&worker_scores[worker], 1, MPI_INT, worker, 1, MPI_COMM_WORLD, &requests[worker - 1]);
                     
@@ -606,9 +625,18 @@ std::optional<Move> best_move_search(Position& pos, SearchGlobals& search_global
         
         // Clear transposition table for clean search
         tt.clear();
+        new_search_history();
         
+        int previous_score = 0;
         for (int depth = 1; depth <= max_depth; ++depth) {
-            auto search_result = search(pos, search_globals, depth);
+            auto window = AspirationWindow::new_aspiration_window(depth, previous_score);
+            auto search_result =
+                search_root(pos, search_globals, depth, window.alpha, window.beta);
+            while (!search_globals.stop() && window.widen(search_result.score)) {
+                search_result =
+                    search_root(pos, search_globals, depth, window.alpha, window.beta);
+            }
+            previous_score = search_result.score;
 
             if (depth > 1 && search_globals.stop()) {
                 return best_move;
@@ -694,31 +722,37 @@ void mpi_worker_loop() {
         int search_depth;
         MPI_Recv(&search_depth, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
 
+        // Receive the root window, which the worker sees from the other side
+        std::array<int, 2> window;
+        MPI_Recv(window.data(), 2, MPI_INT, 0, 0, MPI_COMM_WORLD, &status);
+
         // Create position and search
         Position worker_pos(fen);
         
         // Reset worker's node count before search
         uint64_t initial_nodes = search_globals.nodes();
-        auto result = search_impl(worker_pos, -INFINITE, INFINITE, search_depth - 1, 
+        int score = search_impl(worker_pos, -window[1], -window[0], search_depth - 1,
                                 search_stack.begin() + 1, search_globals);
         uint64_t nodes_searched = search_globals.nodes() - initial_nodes;
 
         // Send result back
-        MPI_Send(&result.score, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
+        MPI_Send(&score, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
         
         // Send node count
         MPI_Send(&nodes_searched, 1, MPI_UNSIGNED_LONG_LONG, 0, 1, MPI_COMM_WORLD);
         
-        // Send PV
-        int pv_length = result.pv ? result.pv->size() : 0;
+        // Send PV, read straight out of the worker's PV table. Moves are sent whole since they
+        // do not fit in 16 bits
+        const SearchStack& worker_ss = search_stack[1];
+        int pv_length = worker_ss.pv_length;
         MPI_Send(&pv_length, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
-        
+
         if (pv_length > 0) {
-            std::vector<uint16_t> pv_values;
-            for (auto move : *result.pv) {
-                pv_values.push_back(move.value());
+            std::array<uint32_t, MAX_PLY> pv_values;
+            for (int i = 0; i < pv_length; ++i) {
+                pv_values[i] = worker_ss.pv[i].value();
             }
-            MPI_Send(pv_values.data(), pv_length, MPI_UNSIGNED_SHORT, 0, 1, MPI_COMM_WORLD);
+            MPI_Send(pv_values.data(), pv_length, MPI_UINT32_T, 0, 1, MPI_COMM_WORLD);
         }
     }
 }
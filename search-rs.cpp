@@ -1,95 +1,104 @@
+#include <algorithm>
 #include <chrono>
+#include <vector>
 
 #include "evaluation.h"
+#include "movepick.h"
+#include "pruning.h"
 #include "search.h"
+#include "see.h"
 #include "omp.h"
 
-// #include "tt.h" // Commenting out TT
+#include "tt.h"
 
 using namespace libchess;
 using namespace eval;
 
 namespace search {
 
+// Nodes searched by the calling thread, used to measure the subtree size of each root move
+thread_local std::uint64_t thread_nodes = 0;
+
+// A root move together with what the previous iteration learned about it
+struct RootMove {
+    Move move;
+    // Exact score from the last iteration, or -INFINITE if the move failed low
+    int score;
+    std::uint64_t nodes;
+    MoveList pv;
+};
+
 // SearchStack implementation
-std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
-    std::array<SearchStack, MAX_PLY> search_stack{};
+std::array<SearchStack, SEARCH_STACK_SIZE> SearchStack::new_search_stack() noexcept {
+    std::array<SearchStack, SEARCH_STACK_SIZE> search_stack{};
     for (unsigned i = 0; i < search_stack.size(); ++i) {
         auto& ss = search_stack[i];
         ss.ply = int(i);
-        // ss.killer_moves = {{std::nullopt, std::nullopt}}; // Commenting out Killer Move
+        ss.static_eval = NO_STATIC_EVAL;
     }
     return search_stack;
 }
 
-void sort_moves(const Position& pos, MoveList& move_list, SearchStack* ss,
-                std::optional<Move> tt_move = {}) {
-    move_list.sort([&](Move move) {
-        auto from_pt = *pos.piece_type_on(move.from_square());
-        auto to_pt = pos.piece_type_on(move.to_square());
-
-        int pawn_value = eval::MATERIAL[constants::PAWN][MIDGAME];
-        int equality_bound = pawn_value - 50;
-        if (tt_move && move == *tt_move) {
-            return 20000;
-        } else if (move.type() == Move::Type::ENPASSANT) {
-            return 10000 + pawn_value + 20;
-        } else if (to_pt) {
-            int capture_value = eval::MATERIAL[*to_pt][MIDGAME] - eval::MATERIAL[from_pt][MIDGAME];
-            if (capture_value >= equality_bound) {
-                return 10000 + capture_value;
-            } else {
-                return 5000 + capture_value;
-            }
-        // } else if (ss->killer_moves[0] && move == *ss->killer_moves[0]) {
-        //    return 7001;
-        //} else if (ss->killer_moves[1] && move == *ss->killer_moves[1]) {
-        //    return 7000;
-        } else {
-            return 0;
-        }
-    });
-}
-
 int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg) {
     if (sg.stop()) {
         return 0;
     }
 
     sg.increment_nodes();
+    ++thread_nodes;
 
     if (ss->ply >= MAX_PLY) {
         return evaluate(pos);
     }
 
-    int eval = evaluate(pos);
-    if (eval > alpha) {
-        alpha = eval;
-    }
-    if (eval >= beta) {
-        return beta;
-    }
+    ss->refresh_accumulator(pos);
 
-    MoveList move_list;
-    if (pos.in_check()) {
-        move_list = pos.check_evasion_move_list();
+    bool pv_node = alpha != beta - 1;
 
-        if (move_list.empty()) {
-            return pos.in_check() ? -MATE_SCORE + ss->ply : 0;
+    auto hash = pos.hash();
+    TTEntry tt_entry = tt.probe(hash);
+    Move tt_move{0};
+    if (tt_entry.get_key() == hash) {
+        tt_move = Move{tt_entry.get_move()};
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
+        int tt_flag = tt_entry.get_flag();
+        if (!pv_node && (tt_flag == TTConstants::FLAG_EXACT ||
+                         (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
+                         (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha))) {
+            return tt_score;
         }
-    } else {
-        pos.generate_capture_moves(move_list, pos.side_to_move());
-        pos.generate_promotions(move_list, pos.side_to_move());
     }
 
-    sort_moves(pos, move_list, ss);
+    int old_alpha = alpha;
+
+    // In check only evasions are generated and standing pat is not an option, so every evasion is
+    // searched from -INFINITE and a position without one is mate
+    bool in_check = pos.in_check();
+    ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    int eval = ss->static_eval;
+    if (!in_check) {
+        if (eval > alpha) {
+            alpha = eval;
+        }
+        if (eval >= beta) {
+            return beta;
+        }
+    }
+    auto picker = MovePicker::new_qsearch_picker(pos, tt_move);
 
     int best_score = -INFINITE;
-    for (auto move : move_list) {
-        if (!pos.is_legal_generated_move(move)) {
-            continue;
+    std::optional<Move> best_move;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
+        if (!in_check) {
+            // Skip captures that lose material, and those that cannot lift the score to alpha
+            // even with a safety margin on top of what SEE says they win
+            int gain = see(pos, move);
+            if (gain < 0 || eval + gain + DELTA_MARGIN <= alpha) {
+                continue;
+            }
         }
-        pos.make_move(move);
+        ss->make_move(pos, move, *(ss + 1));
         int score = -qsearch_impl(pos, -beta, -alpha, ss + 1, sg);
         pos.unmake_move();
 
@@ -101,6 +110,7 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
             best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
                 if (alpha >= beta) {
                     break;
                 }
@@ -108,90 +118,277 @@ int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlob
         }
     }
 
+    // Only evasions are generated in check, so no legal move there means mate
+    if (best_score == -INFINITE && in_check) {
+        return -MATE_SCORE + ss->ply;
+    }
+
+    int tt_flag = alpha >= beta       ? TTConstants::FLAG_LOWER
+                  : alpha > old_alpha ? TTConstants::FLAG_EXACT
+                                      : TTConstants::FLAG_UPPER;
+    tt.write(best_move ? best_move->value() : 0, tt_flag, TTConstants::DEPTH_QSEARCH,
+             score_to_tt(alpha, ss->ply), hash);
+
     return alpha;
 }
 
 
-SearchResult search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
-                         SearchGlobals& sg) {
+int search_impl(Position& pos, int alpha, int beta, int depth, SearchStack* ss,
+                SearchGlobals& sg) {
+    ss->clear_pv();
+
     if (depth <= 0) {
-        return {qsearch_impl(pos, alpha, beta, ss, sg), {}};
+        return qsearch_impl(pos, alpha, beta, ss, sg);
     }
 
     if (ss->ply) {
         if (sg.stop()) {
-            return {0, {}};
+            return 0;
         }
 
         if (pos.halfmoves() >= 100 || pos.is_repeat()) {
-            return {0, {}};
+            return 0;
         }
 
         if (ss->ply >= MAX_PLY) {
-            return {evaluate(pos), {}};
+            return evaluate(pos);
         }
 
         alpha = std::max((-MATE_SCORE + ss->ply), alpha);
         beta = std::min((MATE_SCORE - ss->ply), beta);
         if (alpha >= beta) {
-            return {alpha, {}};
+            return alpha;
         }
     }
 
     bool pv_node = alpha != beta - 1;
 
-    sg.increment_nodes();
+    auto hash = pos.hash();
+    TTEntry tt_entry = tt.probe(hash);
+    Move tt_move{0};
+    if (tt_entry.get_key() == hash) {
+        tt_move = Move{tt_entry.get_move()};
+        int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
+        int tt_flag = tt_entry.get_flag();
+        if (!pv_node && tt_entry.get_depth() >= depth) {
+            if (tt_flag == TTConstants::FLAG_EXACT ||
+                (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
+                (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha)) {
+                return tt_score;
+            }
+        }
+    }
 
-    MoveList pv;
-    int best_score = -INFINITE;
-    auto move_list = pos.legal_move_list();
+    ss->refresh_accumulator(pos);
 
-    if (move_list.empty()) {
-        return {pos.in_check() ? -MATE_SCORE + ss->ply : 0, {}};
+    bool in_check = pos.in_check();
+    // A null move verification search revisits this node and keeps the eval of the first visit
+    if (!ss->skip_null_move) {
+        ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+    }
+    bool improving = ss->improving();
+    if (reverse_futility_prune(pos, ss, beta, depth, pv_node, in_check)) {
+        return ss->static_eval;
+    }
+    auto null_search = [&](int alpha_, int beta_, int depth_, SearchStack* ss_) {
+        return search_impl(pos, alpha_, beta_, depth_, ss_, sg);
+    };
+    if (auto score = null_move_cutoff(pos, beta, depth, pv_node, in_check, ss, null_search)) {
+        return *score;
     }
 
-    sort_moves(pos, move_list, ss);
+    sg.increment_nodes();
+    ++thread_nodes;
 
-    int move_num = 0;
+    int old_alpha = alpha;
+    int best_score = -INFINITE;
+    std::optional<Move> best_move;
+    MoveHistory& history = thread_history();
+    auto picker = MovePicker::new_main_picker(pos, tt_move, ss->killers, history);
 
-    for (auto move : move_list) {
+    int move_num = 0;
+    int quiet_count = 0;
+    std::array<Move, 64> quiets_searched;
+    while (auto next_move = picker.next_move()) {
+        Move move = *next_move;
         ++move_num;
 
-        pos.make_move(move);
-        SearchResult search_result =
-            move_num == 1 ? -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg)
-                          : -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
-        if (move_num > 1 && search_result.score > alpha) {
-            search_result = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+        ss->make_move(pos, move, *(ss + 1));
+        int score;
+        if (move_num == 1) {
+            score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+        } else {
+            int reduction = late_move_reduction(move, depth, move_num, pv_node, improving,
+                                                in_check, pos.in_check());
+            score = -search_impl(pos, -alpha - 1, -alpha, depth - 1 - reduction, ss + 1, sg);
+            if (reduction && score > alpha) {
+                score = -search_impl(pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
+            }
+            if (score > alpha && score < beta) {
+                score = -search_impl(pos, -beta, -alpha, depth - 1, ss + 1, sg);
+            }
         }
         pos.unmake_move();
 
         if (ss->ply && sg.stop()) {
-            return {0, {}};
+            return 0;
+        }
+
+        if (!is_noisy(move) && quiet_count < int(quiets_searched.size())) {
+            quiets_searched[quiet_count++] = move;
         }
 
-        if (search_result.score > best_score) {
-            best_score = search_result.score;
+        if (score > best_score) {
+            best_score = score;
             if (best_score > alpha) {
                 alpha = best_score;
+                best_move = move;
 
                 if (pv_node) {
-                    pv.clear();
-                    pv.add(move);
-                    if (search_result.pv) {
-                        pv.add(*search_result.pv);
-                    }
+                    ss->update_pv(move, *(ss + 1));
                 }
 
                 if (alpha >= beta) {
+                    if (!is_noisy(move)) {
+                        ss->update_killers(move);
+                        history.update(pos, move, quiets_searched.data(), quiet_count, depth);
+                    }
                     break;
                 }
             }
         }
     }
-    return {best_score, pv};
+
+    if (!move_num) {
+        return in_check ? -MATE_SCORE + ss->ply : 0;
+    }
+
+    int tt_flag = best_score >= beta       ? TTConstants::FLAG_LOWER
+                  : best_score > old_alpha ? TTConstants::FLAG_EXACT
+                                           : TTConstants::FLAG_UPPER;
+    tt.write(best_move ? best_move->value() : 0, tt_flag, depth,
+             score_to_tt(best_score, ss->ply), hash);
+    return best_score;
+}
+
+// Root splitting: the first (previously best) root move is searched alone to establish alpha,
+// then the remaining moves are split across the threads. Those are searched with a null window
+// around the shared alpha and only re-searched with the full window when they fail high. All
+// threads share the aspiration window; the returned score is outside it when the root fails.
+SearchResult search_root(Position& pos, std::vector<RootMove>& root_moves, SearchGlobals& sg,
+                         int depth, int alpha, int beta) {
+    if (root_moves.empty()) {
+        return {pos.in_check() ? -MATE_SCORE : 0, {}};
+    }
+
+    // Best move of the previous iteration first, then the moves that failed low ordered by
+    // the size of their subtrees, which tracks how hard they were to refute
+    std::stable_sort(root_moves.begin(), root_moves.end(),
+                     [](const RootMove& lhs, const RootMove& rhs) {
+                         if (lhs.score != rhs.score) {
+                             return lhs.score > rhs.score;
+                         }
+                         return lhs.nodes > rhs.nodes;
+                     });
+
+    int best_index = 0;
+
+    {
+        auto search_stack = SearchStack::new_search_stack();
+        RootMove& root_move = root_moves[0];
+        Position child = pos;
+        child.make_move(root_move.move);
+        thread_nodes = 0;
+        int score = -search_impl(child, -beta, -alpha, depth - 1, search_stack.begin() + 1, sg);
+        root_move.nodes = thread_nodes;
+        root_move.score = score;
+        root_move.pv.clear();
+        root_move.pv.add(root_move.move);
+        root_move.pv.add(search_stack[1].pv_move_list());
+        alpha = std::max(alpha, score);
+    }
+
+    if (sg.stop() || alpha >= beta) {
+        for (std::size_t i = 1; i < root_moves.size(); ++i) {
+            root_moves[i].score = -INFINITE;
+        }
+        return {root_moves[0].score, root_moves[0].pv};
+    }
+
+    int num_moves = int(root_moves.size());
+
+#pragma omp parallel
+    {
+        auto search_stack = SearchStack::new_search_stack();
+
+#pragma omp for schedule(dynamic, 1)
+        for (int i = 1; i < num_moves; ++i) {
+            RootMove& root_move = root_moves[i];
+
+            int local_alpha;
+#pragma omp atomic read
+            local_alpha = alpha;
+            // Another move already failed high, the rest of this iteration is wasted
+            if (local_alpha >= beta) {
+                continue;
+            }
+
+            Position child = pos;
+            child.make_move(root_move.move);
+            thread_nodes = 0;
+
+            int score = -search_impl(child, -local_alpha - 1, -local_alpha, depth - 1,
+                                     search_stack.begin() + 1, sg);
+            if (score > local_alpha && !sg.stop()) {
+                score = -search_impl(child, -beta, -local_alpha, depth - 1,
+                                     search_stack.begin() + 1, sg);
+            }
+            root_move.nodes = thread_nodes;
+
+#pragma omp critical
+            {
+                if (!sg.stop() && score > alpha) {
+#pragma omp atomic write
+                    alpha = score;
+                    best_index = i;
+                    root_move.score = score;
+                    root_move.pv.clear();
+                    root_move.pv.add(root_move.move);
+                    root_move.pv.add(search_stack[1].pv_move_list());
+                } else {
+                    root_move.score = -INFINITE;
+                }
+            }
+        }
+    }
+
+    // Only the best move keeps an exact score, so that it leads the next iteration
+    for (int i = 0; i < num_moves; ++i) {
+        if (i != best_index) {
+            root_moves[i].score = -INFINITE;
+        }
+    }
+
+    return {root_moves[best_index].score, root_moves[best_index].pv};
 }
 
+std::vector<RootMove> root_move_list(Position& pos) {
+    auto hash = pos.hash();
+    TTEntry tt_entry = tt.probe(hash);
+    Move tt_move{0};
+    if (tt_entry.get_key() == hash) {
+        tt_move = Move{tt_entry.get_move()};
+    }
+
+    // Scores decrease in picking order so the initial sort keeps the move ordering
+    std::vector<RootMove> root_moves;
+    auto picker = MovePicker::new_main_picker(pos, tt_move, {}, thread_history());
+    int order = 0;
+    while (auto move = picker.next_move()) {
+        root_moves.push_back({*move, -order++, 0, {}});
+    }
+    return root_moves;
+}
 
 int qsearch(Position& pos) {
     auto search_stack = SearchStack::new_search_stack();
@@ -200,52 +397,35 @@ int qsearch(Position& pos) {
 }
 
 SearchResult search(Position& pos, SearchGlobals& sg, int depth) {
-    auto search_stack = SearchStack::new_search_stack();
-    int alpha = -INFINITE;
-    int beta = +INFINITE;
-    SearchResult search_result = search_impl(pos, alpha, beta, depth, search_stack.begin(), sg);
-    return search_result;
+    auto root_moves = root_move_list(pos);
+    return search_root(pos, root_moves, sg, depth, -INFINITE, +INFINITE);
 }
 
 SearchResult search(Position& pos, int depth) {
-    auto search_stack = SearchStack::new_search_stack();
     auto search_globals = SearchGlobals::new_search_globals();
-
-    MoveList moves = pos.legal_move_list();
-    sort_moves(pos, moves, search_stack.begin());
-
-    SearchResult best_result = {INFINITE, {}};
-    omp_set_num_threads(8);
-
-    #pragma omp parallel
-    {
-        SearchResult local_best = {INFINITE, {}};
-        #pragma omp for schedule(dynamic)
-        for (auto it = moves.begin(); it != moves.end(); ++it) {
-            Position new_pos = pos;
-            new_pos.make_move(*it);
-            int local_alpha = -INFINITE;
-            int local_beta = INFINITE;
-            SearchResult result = search_impl(new_pos, local_alpha, local_beta, depth - 1, search_stack.begin() + 1, search_globals);
-            result.score = -result.score;
-            local_best.merge(result);
-        }
-        #pragma omp critical
-        best_result.merge(local_best);
-    }
-
-    return best_result;
+    return search(pos, search_globals, depth);
 }
 
 std::optional<Move> best_move_search(Position& pos, SearchGlobals& search_globals, int max_depth) {
     std::optional<Move> best_move;
+    tt.new_search();
+    new_search_history();
     auto start_time = curr_time();
     search_globals.set_stop_flag(false);
     search_globals.set_side_to_move(pos.side_to_move());
     search_globals.reset_nodes();
     search_globals.set_start_time(start_time);
+
+    auto root_moves = root_move_list(pos);
+    int previous_score = 0;
     for (int depth = 1; depth <= max_depth; ++depth) {
-        auto search_result = search(pos, search_globals, depth);
+        auto window = AspirationWindow::new_aspiration_window(depth, previous_score);
+        auto search_result =
+            search_root(pos, root_moves, search_globals, depth, window.alpha, window.beta);
+        while (!search_globals.stop() && window.widen(search_result.score)) {
+            search_result =
+                search_root(pos, root_moves, search_globals, depth, window.alpha, window.beta);
+        }
 
         if (depth > 1 && search_globals.stop()) {
             return best_move;
@@ -254,6 +434,7 @@ std::optional<Move> best_move_search(Position& pos, SearchGlobals& search_global
         auto time_diff = curr_time() - start_time;
 
         int score = search_result.score;
+        previous_score = score;
         auto& pv = search_result.pv;
         if (!pv) {
             break;
@@ -296,4 +477,4 @@ std::optional<Move> best_move_search(Position& pos, SearchGlobals& search_global
     return best_move;
 }
 
-} // namespace search
\ No newline at end of file
+} // namespace search
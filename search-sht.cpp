@@ -1,6 +1,10 @@
 #include <chrono>
+#include <memory>
 #include "evaluation.h"
+#include "movepick.h"
+#include "pruning.h"
 #include "search.h"
+#include "see.h"
 #include "tt.h" // Re-enable the transposition table
 
 #include <omp.h>
@@ -11,40 +15,16 @@ using namespace eval;
 namespace search {
 
 // SearchStack implementation
-std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
-    std::array<SearchStack, MAX_PLY> search_stack{};
+std::array<SearchStack, SEARCH_STACK_SIZE> SearchStack::new_search_stack() noexcept {
+    std::array<SearchStack, SEARCH_STACK_SIZE> search_stack{};
     for (unsigned i = 0; i < search_stack.size(); ++i) {
         auto& ss = search_stack[i];
         ss.ply = int(i);
+        ss.static_eval = NO_STATIC_EVAL;
     }
     return search_stack;
 }
 
-    void sort_moves(const Position& pos, MoveList& move_list, SearchStack* ss,
-                    std::optional<Move> tt_move = {}) {
-        move_list.sort([&](Move move) {
-            auto from_pt = *pos.piece_type_on(move.from_square());
-            auto to_pt = pos.piece_type_on(move.to_square());
-
-            int pawn_value = eval::MATERIAL[constants::PAWN][MIDGAME];
-            int equality_bound = pawn_value - 50;
-            if (tt_move && move == *tt_move) {
-                return 20000;
-            } else if (move.type() == Move::Type::ENPASSANT) {
-                return 10000 + pawn_value + 20;
-            } else if (to_pt) {
-                int capture_value = eval::MATERIAL[*to_pt][MIDGAME] - eval::MATERIAL[from_pt][MIDGAME];
-                if (capture_value >= equality_bound) {
-                    return 10000 + capture_value;
-                } else {
-                    return 5000 + capture_value;
-                }
-            } else {
-                return 0;
-            }
-        });
-    }
-
     int qsearch_impl(Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg) {
         if (sg.stop()) {
             return 0;
@@ -56,34 +36,54 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
             return evaluate(pos);
         }
 
-        int eval = evaluate(pos);
-        if (eval > alpha) {
-            alpha = eval;
-        }
-        if (eval >= beta) {
-            return beta;
-        }
+        ss->refresh_accumulator(pos);
 
-        MoveList move_list;
-        if (pos.in_check()) {
-            move_list = pos.check_evasion_move_list();
+        bool pv_node = alpha != beta - 1;
 
-            if (move_list.empty()) {
-                return pos.in_check() ? -MATE_SCORE + ss->ply : 0;
+        auto hash = pos.hash();
+        TTEntry tt_entry = tt.probe(hash);
+        Move tt_move{0};
+        if (tt_entry.get_key() == hash) {
+            tt_move = Move{tt_entry.get_move()};
+            int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
+            int tt_flag = tt_entry.get_flag();
+            if (!pv_node && (tt_flag == TTConstants::FLAG_EXACT ||
+                             (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
+                             (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha))) {
+                return tt_score;
             }
-        } else {
-            pos.generate_capture_moves(move_list, pos.side_to_move());
-            pos.generate_promotions(move_list, pos.side_to_move());
         }
 
-        sort_moves(pos, move_list, ss);
+        int old_alpha = alpha;
+
+        // In check only evasions are generated and standing pat is not an option, so every
+        // evasion is searched from -INFINITE and a position without one is mate
+        bool in_check = pos.in_check();
+        ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+        int eval = ss->static_eval;
+        if (!in_check) {
+            if (eval > alpha) {
+                alpha = eval;
+            }
+            if (eval >= beta) {
+                return beta;
+            }
+        }
+        auto picker = MovePicker::new_qsearch_picker(pos, tt_move);
 
         int best_score = -INFINITE;
-        for (auto move : move_list) {
-            if (!pos.is_legal_generated_move(move)) {
-                continue;
+        std::optional<Move> best_move;
+        while (auto next_move = picker.next_move()) {
+            Move move = *next_move;
+            if (!in_check) {
+                // Skip captures that lose material, and those that cannot lift the score to alpha
+                // even with a safety margin on top of what SEE says they win
+                int gain = see(pos, move);
+                if (gain < 0 || eval + gain + DELTA_MARGIN <= alpha) {
+                    continue;
+                }
             }
-            pos.make_move(move);
+            ss->make_move(pos, move, *(ss + 1));
             int score = -qsearch_impl(pos, -beta, -alpha, ss + 1, sg);
             pos.unmake_move();
 
@@ -95,6 +95,7 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
                 best_score = score;
                 if (best_score > alpha) {
                     alpha = best_score;
+                    best_move = move;
                     if (alpha >= beta) {
                         break;
                     }
@@ -102,64 +103,107 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
             }
         }
 
+        // Only evasions are generated in check, so no legal move there means mate
+        if (best_score == -INFINITE && in_check) {
+            return -MATE_SCORE + ss->ply;
+        }
+
+        int tt_flag = alpha >= beta       ? TTConstants::FLAG_LOWER
+                      : alpha > old_alpha ? TTConstants::FLAG_EXACT
+                                          : TTConstants::FLAG_UPPER;
+        tt.write(best_move ? best_move->value() : 0, tt_flag, TTConstants::DEPTH_QSEARCH,
+                 score_to_tt(alpha, ss->ply), hash);
+
         return alpha;
     }
 
 
 
 
-    search::SearchResult search_impl(libchess::Position& pos, int alpha, int beta, int depth, search::SearchStack* ss, search::SearchGlobals& sg) {
+    int search_impl(libchess::Position& pos, int alpha, int beta, int depth, search::SearchStack* ss, search::SearchGlobals& sg) {
+        ss->clear_pv();
+
         if (depth <= 0) {
-            return {qsearch_impl(pos, alpha, beta, ss, sg), libchess::MoveList()};
+            return qsearch_impl(pos, alpha, beta, ss, sg);
         }
 
         if (ss->ply) {
             if (sg.stop()) {
-                return {0, libchess::MoveList()};
+                return 0;
             }
             if (pos.halfmoves() >= 100 || pos.is_repeat()) {
-                return {0, libchess::MoveList()};
+                return 0;
             }
             if (ss->ply >= search::MAX_PLY) {
-                return {evaluate(pos), libchess::MoveList()};
+                return evaluate(pos);
             }
 
             alpha = std::max((-search::MATE_SCORE + ss->ply), alpha);
             beta = std::min((search::MATE_SCORE - ss->ply), beta);
             if (alpha >= beta) {
-                return {alpha, libchess::MoveList()};
+                return alpha;
             }
         }
 
         bool pv_node = alpha != beta - 1;
         auto hash = pos.hash();
         TTEntry tt_entry = tt.probe(hash);
-        std::optional<libchess::Move> tt_move;
+        libchess::Move tt_move{0};
         if (tt_entry.get_key() == hash) {
             tt_move = libchess::Move{tt_entry.get_move()};
-            int tt_score = tt_entry.get_score();
+            int tt_score = score_from_tt(tt_entry.get_score(), ss->ply);
             int tt_flag = tt_entry.get_flag();
             if (!pv_node && tt_entry.get_depth() >= depth) {
                 if (tt_flag == TTConstants::FLAG_EXACT ||
                     (tt_flag == TTConstants::FLAG_LOWER && tt_score >= beta) ||
                     (tt_flag == TTConstants::FLAG_UPPER && tt_score <= alpha)) {
-                    return {tt_score, libchess::MoveList()};
+                    return tt_score;
                 }
             }
         }
 
+        ss->refresh_accumulator(pos);
+
+        bool in_check = pos.in_check();
+        // A null move verification search revisits this node and keeps the eval of the first visit
+        if (!ss->skip_null_move) {
+            ss->static_eval = in_check ? NO_STATIC_EVAL : evaluate(pos, ss->accumulator);
+        }
+        bool improving = ss->improving();
+        if (reverse_futility_prune(pos, ss, beta, depth, pv_node, in_check)) {
+            return ss->static_eval;
+        }
+        auto null_search = [&](int alpha_, int beta_, int depth_, SearchStack* ss_) {
+            return search_impl(pos, alpha_, beta_, depth_, ss_, sg);
+        };
+        if (auto score = null_move_cutoff(pos, beta, depth, pv_node, in_check, ss, null_search)) {
+            return *score;
+        }
+
         sg.increment_nodes();
-        libchess::MoveList pv;
         int best_score = -INFINITE;
-        auto move_list = pos.legal_move_list();
+        // Every move is handed to the threads at once, so the picker is only used for ordering
+        MoveList move_list;
+        auto picker = MovePicker::new_main_picker(pos, tt_move, ss->killers, thread_history());
+        while (auto move = picker.next_move()) {
+            move_list.add(*move);
+        }
         if (move_list.empty()) {
-            return {pos.in_check() ? -search::MATE_SCORE + ss->ply : 0, libchess::MoveList()};
+            return in_check ? -search::MATE_SCORE + ss->ply : 0;
         }
 
-        sort_moves(pos, move_list, ss, tt_move);
-
         #pragma omp parallel
         {
+            // Nested regions run on a single thread and can keep using the caller's stack, but
+            // the threads of the outermost region each need their own so child PVs don't clash
+            std::unique_ptr<std::array<SearchStack, SEARCH_STACK_SIZE>> thread_stack;
+            SearchStack* child_ss = ss + 1;
+            if (omp_get_num_threads() > 1) {
+                thread_stack = std::make_unique<std::array<SearchStack, SEARCH_STACK_SIZE>>(
+                    SearchStack::new_search_stack());
+                child_ss = thread_stack->begin() + ss->ply + 1;
+            }
+
             bool local_stop_search = false;
             #pragma omp for nowait
             for (int i = 0; i < move_list.size(); ++i) {
@@ -169,29 +213,41 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
                 auto move = *move_it;
 
                 Position thread_pos = pos;
-                thread_pos.make_move(move);  // Critical fix: actually make the move!
-                SearchResult search_result =
-                    i == 0 ? -search_impl(thread_pos, -beta, -alpha, depth - 1, ss + 1, sg)
-                           : -search_impl(thread_pos, -alpha - 1, -alpha, depth - 1, ss + 1, sg);
-                if (i > 0 && search_result.score > alpha) {
-                    search_result = -search_impl(thread_pos, -beta, -alpha, depth - 1, ss + 1, sg);
+                ss->make_move(thread_pos, move, *child_ss);
+                int score;
+                if (i == 0) {
+                    score = -search_impl(thread_pos, -beta, -alpha, depth - 1, child_ss, sg);
+                } else {
+                    int reduction = late_move_reduction(move, depth, i + 1, pv_node, improving,
+                                                        in_check, thread_pos.in_check());
+                    score = -search_impl(thread_pos, -alpha - 1, -alpha, depth - 1 - reduction,
+                                         child_ss, sg);
+                    if (reduction && score > alpha) {
+                        score =
+                            -search_impl(thread_pos, -alpha - 1, -alpha, depth - 1, child_ss, sg);
+                    }
+                    if (score > alpha && score < beta) {
+                        score = -search_impl(thread_pos, -beta, -alpha, depth - 1, child_ss, sg);
+                    }
                 }
                 thread_pos.unmake_move();  // Clean up
 
                 #pragma omp critical
                 {
-                    if (search_result.score > best_score) {
-                        best_score = search_result.score;
+                    if (score > best_score) {
+                        best_score = score;
                         if (best_score > alpha) {
                             alpha = best_score;
                             if (pv_node) {
-                                pv.clear();
-                                pv.add(move);
-                                if (search_result.pv) {
-                                    pv.add(*search_result.pv);
-                                }
+                                ss->update_pv(move, *child_ss);
                             }
                             if (alpha >= beta) {
+                                // Moves run concurrently, so there is no meaningful list of
+                                // quiets searched before this one to penalize
+                                if (!is_noisy(move)) {
+                                    ss->update_killers(move);
+                                    thread_history().update(pos, move, nullptr, 0, depth);
+                                }
                                 local_stop_search = true;
                             }
                         }
@@ -202,8 +258,8 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
 
         int tt_flag = best_score >= beta ? TTConstants::FLAG_LOWER
                                          : best_score < alpha ? TTConstants::FLAG_UPPER : TTConstants::FLAG_EXACT;
-        tt.write(tt_move ? tt_move->value() : 0, tt_flag, depth, best_score, hash);
-        return {best_score, pv};
+        tt.write(tt_move.value(), tt_flag, depth, score_to_tt(best_score, ss->ply), hash);
+        return best_score;
     }
 
     int qsearch(Position& pos) {
@@ -216,8 +272,8 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
         auto search_stack = SearchStack::new_search_stack();
         int alpha = -INFINITE;
         int beta = +INFINITE;
-        SearchResult search_result = search_impl(pos, alpha, beta, depth, search_stack.begin(), sg);
-        return search_result;
+        int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), sg);
+        return {score, search_stack[0].pv_move_list()};
     }
 
     // SearchResult search(Position& pos, int depth) {
@@ -247,13 +303,14 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
         auto search_globals = SearchGlobals::new_search_globals();
         int alpha = -INFINITE;
         int beta = +INFINITE;
-        SearchResult search_result = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
-        return search_result;
+        int score = search_impl(pos, alpha, beta, depth, search_stack.begin(), search_globals);
+        return {score, search_stack[0].pv_move_list()};
     }
 
     std::optional<libchess::Move> best_move_search(libchess::Position& pos, SearchGlobals& search_globals, int max_depth) {
         std::optional<libchess::Move> best_move;
-        tt.clear();  // Clear TT for new position, but keep it shared across depths within this search
+        tt.new_search();  // Clear TT for new position (unless loaded warm), but keep it shared across depths
+        new_search_history();
         auto start_time = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::high_resolution_clock::now().time_since_epoch());  // Using curr_time() defined in search.h
         search_globals.set_stop_flag(false);
@@ -262,10 +319,16 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
         search_globals.set_start_time(start_time);
 
         auto search_stack = SearchStack::new_search_stack();
-        
+
+        int score = 0;
         for (int depth = 1; depth <= max_depth; ++depth) {
-            // Call search_impl directly with the correct SearchGlobals
-            auto search_result = search_impl(pos, -INFINITE, +INFINITE, depth, search_stack.begin(), search_globals);
+            // Call search_impl directly with the correct SearchGlobals. The root is split across
+            // the threads, which all search inside the same aspiration window.
+            auto window = AspirationWindow::new_aspiration_window(depth, score);
+            do {
+                score = search_impl(pos, window.alpha, window.beta, depth, search_stack.begin(),
+                                    search_globals);
+            } while (!search_globals.stop() && window.widen(score));
 
             if (depth > 1 && search_globals.stop()) {
                 return best_move;
@@ -274,14 +337,13 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
             auto time_diff = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::high_resolution_clock::now().time_since_epoch()) - start_time;
 
-            int score = search_result.score;
-            auto& pv = search_result.pv;
-            // if (!pv || pv->empty()) {
+            auto pv = search_stack[0].pv_move_list();
+            // if (pv.empty()) {
             //     break;
             // }
 
-            if (pv && !pv->empty()) {
-                best_move = *(pv->begin());
+            if (!pv.empty()) {
+                best_move = *(pv.begin());
             }
 
             libchess::UCIScore uci_score = (score <= -MAX_MATE_SCORE) ?
@@ -302,7 +364,7 @@ std::array<SearchStack, MAX_PLY> SearchStack::new_search_stack() noexcept {
             info_values["nodes"] = nodes;
 
             std::vector<std::string> str_move_list;
-            for (const auto& move : *pv) {
+            for (const auto& move : pv) {
                 str_move_list.push_back(move.to_str());
             }
             info_values["pv"] = libchess::UCIMoveList{str_move_list};
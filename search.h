@@ -1,21 +1,60 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+
+#include "evaluation.h"
 #include "libchess/Position.h"
 #include "libchess/UCIService.h"
 
 namespace search {
 
 static const int MAX_PLY = 128;
+// Nodes at MAX_PLY stop before recursing but are still handed a frame by their parent
+static const int SEARCH_STACK_SIZE = MAX_PLY + 1;
 static const int INFINITE = 30001;
 static const int MATE_SCORE = 30000;
 static const int MAX_MATE_SCORE = MATE_SCORE - MAX_PLY;
 
+// Iterations from this depth on search the root with a window around the previous score
+static const int ASPIRATION_MIN_DEPTH = 5;
+static const int ASPIRATION_DELTA = 25;
+
+// Static eval of a node in check, where there is none to compare against
+static const int NO_STATIC_EVAL = INFINITE + 1;
+
+// Slack given to a capture's SEE gain before quiescence search prunes it as unable to reach alpha
+static const int DELTA_MARGIN = 200;
+
+// Mate scores count plies from the root, but a table entry can be reached at any ply, so they are
+// stored counting from the node instead
+inline int score_to_tt(int score, int ply) noexcept {
+    if (score >= MAX_MATE_SCORE) {
+        return score + ply;
+    } else if (score <= -MAX_MATE_SCORE) {
+        return score - ply;
+    }
+    return score;
+}
+
+inline int score_from_tt(int score, int ply) noexcept {
+    if (score >= MAX_MATE_SCORE) {
+        return score - ply;
+    } else if (score <= -MAX_MATE_SCORE) {
+        return score + ply;
+    }
+    return score;
+}
+
 static inline std::chrono::milliseconds curr_time() {
     return std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::high_resolution_clock::now().time_since_epoch());
 }
 
+// Result of a root search. Inside the tree search_impl only returns a score and the principal
+// variation is assembled in place in the SearchStack.
 struct SearchResult {
 
     SearchResult() : score(INFINITE), pv(std::nullopt) {}
@@ -23,17 +62,39 @@ struct SearchResult {
     SearchResult(int score_, std::optional<libchess::MoveList> pv_) noexcept
         : score(score_), pv(std::move(pv_)) {}
 
-    SearchResult operator-() const noexcept { return {-score, pv}; }
-
     int score;
     std::optional<libchess::MoveList> pv;
+};
 
-    void merge(const SearchResult& other) {
-        if (other.score < score) {
-            score = other.score;
-            pv = other.pv;
+// Root window for one iteration. It starts narrow around the previous iteration's score and,
+// whenever the score falls outside it, is widened on the failing side by a margin that grows by
+// half each time.
+struct AspirationWindow {
+    static AspirationWindow new_aspiration_window(int depth, int previous_score) noexcept {
+        if (depth < ASPIRATION_MIN_DEPTH || std::abs(previous_score) >= MAX_MATE_SCORE) {
+            return {-INFINITE, +INFINITE, ASPIRATION_DELTA};
+        }
+        return {previous_score - ASPIRATION_DELTA, previous_score + ASPIRATION_DELTA,
+                ASPIRATION_DELTA};
+    }
+
+    // Returns whether the root has to be searched again with the widened window
+    [[nodiscard]] bool widen(int score) noexcept {
+        if (score <= alpha && alpha > -INFINITE) {
+            beta = (alpha + beta) / 2;
+            alpha = std::max(score - delta, -INFINITE);
+        } else if (score >= beta && beta < +INFINITE) {
+            beta = std::min(score + delta, +INFINITE);
+        } else {
+            return false;
         }
+        delta += delta / 2;
+        return true;
     }
+
+    int alpha;
+    int beta;
+    int delta;
 };
 
 class SearchGlobals {
@@ -118,16 +179,98 @@ class SearchGlobals {
     std::optional<libchess::UCIGoParameters> go_parameters_;
 };
 
-// Forward declaration for SearchStack
+// Per-ply search state. Each thread owns its own stack; the pv rows of consecutive plies form a
+// triangular PV table, where a node's line is its best move followed by its child's line.
+// Killers are kept per ply as well, while the history tables live in movepick.h.
+// skip_null_move is set while a null move cutoff at this ply is being verified. static_eval is
+// evaluated once per node and shared by the pruning decisions and quiescence stand pat, on top of
+// the ply's eval accumulator, which moves are made through so that it is updated incrementally.
 struct SearchStack {
-    static std::array<SearchStack, MAX_PLY> new_search_stack() noexcept;
+    static std::array<SearchStack, SEARCH_STACK_SIZE> new_search_stack() noexcept;
+
+    void clear_pv() noexcept { pv_length = 0; }
+
+    void update_pv(libchess::Move move, const SearchStack& child) noexcept {
+        int child_length = std::min(child.pv_length, MAX_PLY - 1);
+        pv[0] = move;
+        std::copy(child.pv.begin(), child.pv.begin() + child_length, pv.begin() + 1);
+        pv_length = child_length + 1;
+    }
+
+    // The root and any thread starting on a fresh stack hand search_impl a position the stack
+    // has not seen, and only then is the accumulator computed from scratch, or when a network was
+    // loaded since the accumulator was last computed
+    void refresh_accumulator(const libchess::Position& pos) {
+        if (accumulator.key != pos.hash() || (eval::nnue::active() && !accumulator.network)) {
+            accumulator = eval::Accumulator::new_accumulator(pos, network_slot());
+        }
+    }
+
+    // Where this ply keeps its network accumulator on the calling thread, while one is loaded
+    [[nodiscard]] eval::nnue::Accumulator* network_slot() const {
+        return eval::nnue::active() ? eval::nnue::thread_accumulator(ply) : nullptr;
+    }
+
+    // Play a move on pos and derive the child ply's accumulator from this one. Unmaking is just
+    // pos.unmake_move(), since this ply's accumulator is never modified.
+    void make_move(libchess::Position& pos, libchess::Move move, SearchStack& child) const {
+        if (eval::Accumulator::needs_refresh(pos, move)) {
+            pos.make_move(move);
+            child.accumulator = eval::Accumulator::new_accumulator(pos, child.network_slot());
+            return;
+        }
+        child.accumulator.network = child.network_slot();
+        accumulator.after_move(pos, move, child.accumulator);
+        pos.make_move(move);
+        child.accumulator.key = pos.hash();
+    }
+
+    void make_null_move(libchess::Position& pos, SearchStack& child) const {
+        child.accumulator = accumulator;
+        pos.make_null_move();
+        child.accumulator.key = pos.hash();
+    }
+
+    // Quiet moves that failed high at this ply, most recent first
+    void update_killers(libchess::Move move) noexcept {
+        if (killers[0] != move) {
+            killers[1] = killers[0];
+            killers[0] = move;
+        }
+    }
+
+    // Whether the static eval rose since the side to move last moved. When either eval is
+    // unknown the position counts as improving, which only makes pruning more cautious.
+    [[nodiscard]] bool improving() const noexcept {
+        if (ply < 2 || static_eval == NO_STATIC_EVAL) {
+            return true;
+        }
+        int previous_eval = (this - 2)->static_eval;
+        return previous_eval == NO_STATIC_EVAL || static_eval > previous_eval;
+    }
+
+    [[nodiscard]] libchess::MoveList pv_move_list() const {
+        libchess::MoveList move_list;
+        for (int i = 0; i < pv_length; ++i) {
+            move_list.add(pv[i]);
+        }
+        return move_list;
+    }
+
     int ply;
+    bool skip_null_move;
+    int static_eval;
+    eval::Accumulator accumulator;
+    std::array<libchess::Move, 2> killers;
+    int pv_length;
+    std::array<libchess::Move, MAX_PLY> pv;
 };
 
 int qsearch(libchess::Position&);
+int qsearch_impl(libchess::Position& pos, int alpha, int beta, SearchStack* ss, SearchGlobals& sg);
 SearchResult search(libchess::Position&, int depth);
 SearchResult search(libchess::Position&, SearchGlobals& search_globals, int depth);
-SearchResult search_impl(libchess::Position& pos, int alpha, int beta, int depth, SearchStack* ss, SearchGlobals& sg);
+int search_impl(libchess::Position& pos, int alpha, int beta, int depth, SearchStack* ss, SearchGlobals& sg);
 std::optional<libchess::Move> best_move_search(libchess::Position&, SearchGlobals& search_globals, int max_depth=MAX_PLY);
 void mpi_worker_loop(); // MPI worker function
 
@@ -0,0 +1,105 @@
+#ifndef SEE_H
+#define SEE_H
+
+#include <algorithm>
+#include <array>
+
+#include "evaluation.h"
+#include "libchess/Position.h"
+
+namespace search {
+
+inline int see_piece_value(libchess::PieceType pt) {
+    // The king can only be the last piece to capture, so any exchange that loses it scores badly
+    return pt == libchess::constants::KING ? 20000 : eval::mg_value(eval::MATERIAL[pt]);
+}
+
+inline libchess::Bitboard attackers_to(const libchess::Position& pos, libchess::Square square,
+                                       libchess::Bitboard occupancy) {
+    using namespace libchess;
+    Bitboard diagonal = pos.piece_type_bb(constants::BISHOP) | pos.piece_type_bb(constants::QUEEN);
+    Bitboard straight = pos.piece_type_bb(constants::ROOK) | pos.piece_type_bb(constants::QUEEN);
+    return (lookups::pawn_attacks(square, constants::BLACK) &
+            pos.piece_type_bb(constants::PAWN, constants::WHITE)) |
+           (lookups::pawn_attacks(square, constants::WHITE) &
+            pos.piece_type_bb(constants::PAWN, constants::BLACK)) |
+           (lookups::knight_attacks(square) & pos.piece_type_bb(constants::KNIGHT)) |
+           (lookups::king_attacks(square) & pos.piece_type_bb(constants::KING)) |
+           (lookups::bishop_attacks(square, occupancy) & diagonal) |
+           (lookups::rook_attacks(square, occupancy) & straight);
+}
+
+// Static exchange evaluation: the material balance, from the mover's point of view, of the
+// sequence of captures on the destination square where each side always recaptures with its
+// least valuable piece and may stop whenever continuing would lose material. Pins and checks
+// are ignored.
+inline int see(const libchess::Position& pos, libchess::Move move) {
+    using namespace libchess;
+    if (move.type() == Move::Type::CASTLING) {
+        return 0;
+    }
+
+    Square from = move.from_square();
+    Square to = move.to_square();
+    Color stm = pos.side_to_move();
+    Bitboard occupancy = pos.occupancy_bb() ^ Bitboard{from};
+
+    std::array<int, 32> gain{};
+    int attacker_value = see_piece_value(*pos.piece_type_on(from));
+    if (move.type() == Move::Type::ENPASSANT) {
+        gain[0] = see_piece_value(constants::PAWN);
+        int captured_square = to.value() + (stm == constants::WHITE ? -8 : 8);
+        occupancy ^= Bitboard{Square{captured_square}};
+    } else if (auto captured = pos.piece_type_on(to)) {
+        gain[0] = see_piece_value(*captured);
+    }
+    if (auto promotion = move.promotion_piece_type()) {
+        gain[0] += see_piece_value(*promotion) - see_piece_value(constants::PAWN);
+        attacker_value = see_piece_value(*promotion);
+    }
+
+    Bitboard diagonal = pos.piece_type_bb(constants::BISHOP) | pos.piece_type_bb(constants::QUEEN);
+    Bitboard straight = pos.piece_type_bb(constants::ROOK) | pos.piece_type_bb(constants::QUEEN);
+    Bitboard attackers = attackers_to(pos, to, occupancy) & occupancy;
+
+    int depth = 0;
+    Color side = !stm;
+    while (depth + 1 < int(gain.size())) {
+        Bitboard side_attackers = attackers & pos.color_bb(side);
+        if (!side_attackers) {
+            break;
+        }
+
+        PieceType least_valuable = constants::PAWN;
+        Bitboard least_valuable_bb;
+        for (auto pt : constants::PIECE_TYPES) {
+            least_valuable_bb = side_attackers & pos.piece_type_bb(pt);
+            if (least_valuable_bb) {
+                least_valuable = pt;
+                break;
+            }
+        }
+
+        ++depth;
+        gain[depth] = attacker_value - gain[depth - 1];
+
+        attacker_value = see_piece_value(least_valuable);
+        occupancy ^= Bitboard{least_valuable_bb.forward_bitscan()};
+        // Removing the capturer may uncover a slider behind it
+        attackers |= (lookups::bishop_attacks(to, occupancy) & diagonal) |
+                     (lookups::rook_attacks(to, occupancy) & straight);
+        attackers &= occupancy;
+        side = !side;
+    }
+
+    // Walk back up the sequence letting each side stop capturing when that is better for it
+    while (depth > 0) {
+        gain[depth - 1] = -std::max(-gain[depth - 1], gain[depth]);
+        --depth;
+    }
+    return gain[0];
+}
+
+} // namespace search
+
+#endif // SEE_H
@@ -26,7 +26,16 @@ SOFTWARE.
 #define TT_H
 
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <climits>
 #include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 enum TTConstants {
     FLAG_EXACT = 1,
@@ -41,6 +50,10 @@ enum TTConstants {
     FLAG_MASK = 0x3,
     DEPTH_MASK = 0x7f,
 
+    // Quiescence search entries are stored with this depth; main search entries always have
+    // depth >= 1, so the two can be told apart and quiescence entries never displace the others
+    DEPTH_QSEARCH = 0,
+
     CLUSTER_SIZE = 4
 };
 
@@ -101,47 +114,143 @@ inline void TTCluster::clear() {
         entry.clear();
 }
 
+// On-disk layout of a saved table: this header followed by the raw clusters. The header is padded
+// to a cluster so the clusters stay aligned when the file is mapped straight into memory.
+struct TTFileHeader {
+    char magic[8];
+    std::uint64_t cluster_size;
+    std::uint64_t clusters;
+    char reserved[40];
+};
+
+inline const char TT_FILE_MAGIC[8] = {'L', 'C', 'E', 'T', 'T', '0', '1', '\0'};
+
 struct TranspositionTable {
     TranspositionTable();
     ~TranspositionTable();
     TranspositionTable(int MB);
     void resize(int MB);
+    [[nodiscard]] int megabytes() const;
     TTEntry probe(std::uint64_t key) const;
     void write(std::uint64_t move, std::uint64_t flag, std::uint64_t depth, std::uint64_t score,
                std::uint64_t key);
     void clear();
+    void new_search();
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+    // Whether the entries came from load() and are kept across searches
+    [[nodiscard]] bool loaded() const noexcept { return persistent; }
     int hash(std::uint64_t key) const;
 
   private:
+    void release();
+
     TTCluster* table;
     int size;
+    // Non-null when the clusters live in a private file mapping created by load()
+    void* mapping;
+    std::size_t mapping_bytes;
+    // Set by load() so that new searches keep the warm entries instead of clearing them
+    bool persistent;
 };
 
-inline TranspositionTable::TranspositionTable() {
+inline TranspositionTable::TranspositionTable()
+    : table(nullptr), size(0), mapping(nullptr), mapping_bytes(0), persistent(false) {
     size = (1 << 20) / sizeof(TTCluster);
     table = new TTCluster[size];
     clear();
 }
 
-inline TranspositionTable::~TranspositionTable() {
-    if (table != nullptr) {
+inline TranspositionTable::~TranspositionTable() { release(); }
+
+inline TranspositionTable::TranspositionTable(int MB)
+    : table(nullptr), size(0), mapping(nullptr), mapping_bytes(0), persistent(false) {
+    resize(MB);
+}
+
+inline void TranspositionTable::release() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_bytes);
+    } else if (table != nullptr) {
         delete[] table;
     }
     table = nullptr;
+    mapping = nullptr;
+    mapping_bytes = 0;
 }
 
-inline TranspositionTable::TranspositionTable(int MB) { resize(MB); }
-
 inline void TranspositionTable::resize(int MB) {
     if (MB <= 0)
         MB = 1;
 
+    release();
     size = ((1 << 20) / sizeof(TTCluster)) * MB;
-    delete[] table;
     table = new TTCluster[size];
+    persistent = false;
     clear();
 }
 
+inline int TranspositionTable::megabytes() const {
+    return int(std::size_t(size) * sizeof(TTCluster) >> 20);
+}
+
+inline void TranspositionTable::new_search() {
+    if (!persistent)
+        clear();
+}
+
+inline bool TranspositionTable::save(const std::string& path) const {
+    static_assert(sizeof(TTFileHeader) == sizeof(TTCluster), "header must keep clusters aligned");
+
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    TTFileHeader header{};
+    std::memcpy(header.magic, TT_FILE_MAGIC, sizeof(header.magic));
+    header.cluster_size = sizeof(TTCluster);
+    header.clusters = std::uint64_t(size);
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(table, sizeof(TTCluster), size, file) == std::size_t(size);
+    return std::fclose(file) == 0 && ok;
+}
+
+// Maps a table written by save() copy-on-write, so startup costs nothing beyond the page faults
+// of the entries the search actually touches and the file itself is never modified.
+inline bool TranspositionTable::load(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    TTFileHeader header;
+    bool valid = fstat(fd, &st) == 0 && std::size_t(st.st_size) >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == ssize_t(sizeof(header)) &&
+                 std::memcmp(header.magic, TT_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.cluster_size == sizeof(TTCluster) && header.clusters > 0 &&
+                 header.clusters <= std::uint64_t(INT_MAX) &&
+                 std::uint64_t(st.st_size) == sizeof(header) + header.clusters * sizeof(TTCluster);
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    release();
+    mapping = base;
+    mapping_bytes = st.st_size;
+    table = reinterpret_cast<TTCluster*>(static_cast<char*>(base) + sizeof(header));
+    size = int(header.clusters);
+    persistent = true;
+    return true;
+}
+
 inline void TranspositionTable::clear() {
     for (int i = 0; i < size; ++i)
         table[i].clear();
@@ -157,7 +266,10 @@ inline TTEntry TranspositionTable::probe(std::uint64_t key) const {
 inline void TranspositionTable::write(std::uint64_t move, std::uint64_t flag, std::uint64_t depth,
                                       std::uint64_t score, std::uint64_t key) {
     int index = hash(key);
-    table[index].get_entry(key).set(move, flag, depth, score, key);
+    TTEntry& entry = table[index].get_entry(key);
+    if (depth == DEPTH_QSEARCH && entry.get_depth() != DEPTH_QSEARCH)
+        return;
+    entry.set(move, flag, depth, score, key);
 }
 
 inline TranspositionTable tt(128);
@@ -1,110 +1,231 @@
 #ifndef LIBCHESSENGINE__TUNE_H
 #define LIBCHESSENGINE__TUNE_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "dataset.h"
+#include "evalbatch.h"
 #include "evaluation.h"
 #include "libchess/Position.h"
-#include "libchess/Tuner.h"
+#include "parallel.h"
 
-inline void tune_handler(std::istringstream& line_stream) {
-    std::string line;
-    line_stream >> std::quoted(line);
-    auto normalized_results = libchess::NormalizedResult<libchess::Position>::parse_epd(
-        line, [](const std::string& fen) { return *libchess::Position::from_fen(fen); });
-    std::vector<libchess::TunableParameter> tunable_params{{
-        {"PawnMG", eval::MATERIAL[libchess::constants::PAWN][eval::MIDGAME]},
-        {"PawnEG", eval::MATERIAL[libchess::constants::PAWN][eval::ENDGAME]},
-        {"KnightMG", eval::MATERIAL[libchess::constants::KNIGHT][eval::MIDGAME]},
-        {"KnightEG", eval::MATERIAL[libchess::constants::KNIGHT][eval::ENDGAME]},
-        {"BishopMG", eval::MATERIAL[libchess::constants::BISHOP][eval::MIDGAME]},
-        {"BishopEG", eval::MATERIAL[libchess::constants::BISHOP][eval::ENDGAME]},
-        {"RookMG", eval::MATERIAL[libchess::constants::ROOK][eval::MIDGAME]},
-        {"RookEG", eval::MATERIAL[libchess::constants::ROOK][eval::ENDGAME]},
-        {"QueenMG", eval::MATERIAL[libchess::constants::QUEEN][eval::MIDGAME]},
-        {"QueenEG", eval::MATERIAL[libchess::constants::QUEEN][eval::ENDGAME]},
-        {"Rook7thRankMG", eval::ROOK_7TH_RANK_MG},
-        {"Rook7thRankEG", eval::ROOK_7TH_RANK_EG},
-        {"DoubledPawnMG", eval::DOUBLED_PAWNS_MG},
-        {"DoubledPawnEG", eval::DOUBLED_PAWNS_EG},
-        {"IsolatedPawnMG", eval::ISOLATED_PAWNS_MG},
-        {"IsolatedPawnEG", eval::ISOLATED_PAWNS_EG},
-    }};
-    std::cout << "tuning..."
-              << "\n";
-    auto eval_function = [](libchess::Position& pos,
-                            const std::vector<libchess::TunableParameter>& params) -> int {
-        for (auto& param : params) {
-            if (param.name() == "PawnMG") {
-                eval::MATERIAL[libchess::constants::PAWN] = {
-                    eval::MATERIAL[libchess::constants::PAWN][eval::MIDGAME],
-                    param.value(),
-                };
-            } else if (param.name() == "PawnEG") {
-                eval::MATERIAL[libchess::constants::PAWN] = {
-                    param.value(),
-                    eval::MATERIAL[libchess::constants::PAWN][eval::ENDGAME],
-                };
-            } else if (param.name() == "KnightMG") {
-                eval::MATERIAL[libchess::constants::KNIGHT] = {
-                    eval::MATERIAL[libchess::constants::KNIGHT][eval::MIDGAME],
-                    param.value(),
-                };
-            } else if (param.name() == "KnightEG") {
-                eval::MATERIAL[libchess::constants::KNIGHT] = {
-                    param.value(),
-                    eval::MATERIAL[libchess::constants::KNIGHT][eval::ENDGAME],
-                };
-            } else if (param.name() == "BishopMG") {
-                eval::MATERIAL[libchess::constants::BISHOP] = {
-                    eval::MATERIAL[libchess::constants::BISHOP][eval::MIDGAME],
-                    param.value(),
-                };
-            } else if (param.name() == "BishopEG") {
-                eval::MATERIAL[libchess::constants::BISHOP] = {
-                    param.value(),
-                    eval::MATERIAL[libchess::constants::BISHOP][eval::ENDGAME],
-                };
-            } else if (param.name() == "RookMG") {
-                eval::MATERIAL[libchess::constants::ROOK] = {
-                    eval::MATERIAL[libchess::constants::ROOK][eval::MIDGAME],
-                    param.value(),
-                };
-            } else if (param.name() == "RookEG") {
-                eval::MATERIAL[libchess::constants::ROOK] = {
-                    param.value(),
-                    eval::MATERIAL[libchess::constants::ROOK][eval::ENDGAME],
-                };
-            } else if (param.name() == "QueenMG") {
-                eval::MATERIAL[libchess::constants::QUEEN] = {
-                    eval::MATERIAL[libchess::constants::QUEEN][eval::MIDGAME],
-                    param.value(),
-                };
-            } else if (param.name() == "QueenEG") {
-                eval::MATERIAL[libchess::constants::QUEEN] = {
-                    param.value(),
-                    eval::MATERIAL[libchess::constants::QUEEN][eval::ENDGAME],
-                };
-            } else if (param.name() == "Rook7thRankMG") {
-                eval::ROOK_7TH_RANK_MG = param.value();
-            } else if (param.name() == "Rook7thRankEG") {
-                eval::ROOK_7TH_RANK_EG = param.value();
-            } else if (param.name() == "DoubledPawnMG") {
-                eval::DOUBLED_PAWNS_MG = param.value();
-            } else if (param.name() == "DoubledPawnEG") {
-                eval::DOUBLED_PAWNS_EG = param.value();
-            } else if (param.name() == "IsolatedPawnMG") {
-                eval::ISOLATED_PAWNS_MG = param.value();
-            } else if (param.name() == "IsolatedPawnEG") {
-                eval::ISOLATED_PAWNS_EG = param.value();
-            }
+namespace tune {
+
+// Texel tuning fits the weights to game results by minimising the mean squared difference between
+// each result and a sigmoid of the position's static evaluation
+inline const double SIGMOID_K = 1.0;
+
+// Errors are summed over fixed blocks of positions and the block sums are added in order, so the
+// total does not depend on the number of threads or on which thread took which block
+static const std::size_t ERROR_BLOCK_SIZE = 16384;
+
+inline double sigmoid(int score) {
+    return 1.0 / (1.0 + std::pow(10.0, -SIGMOID_K * score / 400.0));
+}
+
+// Labelled positions, with the result of the game each was taken from: 1 for a white win, 0.5 for
+// a draw and 0 for a black win
+struct TuningData {
+    // Parsed on threads threads
+    static std::optional<TuningData> from_epd(const std::string& path, int threads);
+    static TuningData from_packed(const dataset::PackedPosition* begin,
+                                  const dataset::PackedPosition* end);
+    // Either format, told apart by the packed file header
+    static std::optional<TuningData> from_file(const std::string& path, int threads);
+
+    eval::PositionBatch positions;
+    std::vector<double> results;
+};
+
+inline std::optional<TuningData> TuningData::from_epd(const std::string& path, int threads) {
+    auto records = dataset::read_labelled_epd(path, threads);
+    if (!records) {
+        return {};
+    }
+    return from_packed(records->data(), records->data() + records->size());
+}
+
+inline TuningData TuningData::from_packed(const dataset::PackedPosition* begin,
+                                          const dataset::PackedPosition* end) {
+    std::size_t size = end - begin;
+    TuningData data{eval::PositionBatch::new_position_batch(size), {}};
+    data.results.reserve(size);
+    for (auto packed = begin; packed != end; ++packed) {
+        data.positions.add(packed->pieces(), packed->black_to_move());
+        data.results.push_back(packed->result());
+    }
+    return data;
+}
+
+inline std::optional<TuningData> TuningData::from_file(const std::string& path, int threads) {
+    if (auto file = dataset::PackedFile::open(path)) {
+        return from_packed(file->begin(), file->end());
+    }
+    return from_epd(path, threads);
+}
+
+// A tunable weight, bound once to the half of the packed evaluation score it is stored in
+struct Parameter {
+    [[nodiscard]] int get() const {
+        return stage == eval::MIDGAME ? eval::mg_value(*score) : eval::eg_value(*score);
+    }
+
+    void set(int value) const {
+        if (stage == eval::MIDGAME) {
+            eval::set_mg_value(*score, value);
+        } else {
+            eval::set_eg_value(*score, value);
         }
-        int evaluation = eval::evaluate(pos);
-        return pos.side_to_move() == libchess::constants::WHITE ? evaluation : -evaluation;
+    }
+
+    std::string name;
+    eval::Score* score;
+    eval::Stage stage;
+};
+
+inline std::vector<Parameter> tunable_parameters() {
+    std::vector<Parameter> params;
+    auto bind = [&params](const std::string& name, eval::Score& score) {
+        params.push_back({name + "MG", &score, eval::MIDGAME});
+        params.push_back({name + "EG", &score, eval::ENDGAME});
     };
-    libchess::Tuner<libchess::Position> tuner{normalized_results, tunable_params, eval_function};
+    const std::array<const char*, 5> piece_names{"Pawn", "Knight", "Bishop", "Rook", "Queen"};
+    for (unsigned pt = 0; pt < piece_names.size(); ++pt) {
+        bind(piece_names[pt], eval::MATERIAL[pt]);
+    }
+    bind("Rook7thRank", eval::ROOK_7TH_RANK);
+    bind("DoubledPawn", eval::DOUBLED_PAWNS);
+    bind("IsolatedPawn", eval::ISOLATED_PAWNS);
+    return params;
+}
+
+// Local search over the parameters, one step at a time, as libchess's Tuner does. The error is
+// computed with the batched evaluator by all threads at once; the data is only read.
+class Tuner {
+  public:
+    Tuner(const TuningData& data, std::vector<Parameter> params, int threads)
+        : data_(data), params_(std::move(params)), threads_(std::max(1, threads)),
+          scores_(data.positions.size) {
+        for (auto& param : params_) {
+            values_.push_back(param.get());
+        }
+        applied_ = values_;
+    }
+
+    // Mean squared error of the current parameter values
+    double error() {
+        apply_changes();
+        auto weights = eval::BatchWeights::new_batch_weights();
+        const auto& positions = data_.positions;
+        std::size_t num_blocks = (positions.size + ERROR_BLOCK_SIZE - 1) / ERROR_BLOCK_SIZE;
+        std::vector<double> block_errors(num_blocks);
+        std::atomic<std::size_t> next_block{0};
+
+        auto worker = [&]() {
+            for (std::size_t block; (block = next_block.fetch_add(1)) < num_blocks;) {
+                std::size_t begin = block * ERROR_BLOCK_SIZE;
+                std::size_t end = std::min(begin + ERROR_BLOCK_SIZE, positions.size);
+                eval::evaluate_batch(positions, weights, begin, end, scores_.data());
+
+                double sum = 0.0;
+                for (std::size_t i = begin; i < end; ++i) {
+                    int white_score = positions.black_to_move[i] ? -scores_[i] : scores_[i];
+                    double diff = data_.results[i] - sigmoid(white_score);
+                    sum += diff * diff;
+                }
+                block_errors[block] = sum;
+            }
+        };
+        parallel::run_on_threads(threads_, worker);
+
+        double total = 0.0;
+        for (double block_error : block_errors) {
+            total += block_error;
+        }
+        return positions.size ? total / positions.size : 0.0;
+    }
+
+    void local_tune() {
+        double best_error = error();
+        bool improved = true;
+        for (int iteration = 1; improved; ++iteration) {
+            improved = false;
+            for (auto& value : values_) {
+                for (int step : {1, -1}) {
+                    value += step;
+                    double new_error = error();
+                    if (new_error < best_error) {
+                        best_error = new_error;
+                        improved = true;
+                        break;
+                    }
+                    value -= step;
+                }
+            }
+            apply_changes();
+            std::cout << "Iteration " << iteration << " error: " << best_error << "\n";
+        }
+    }
+
+    void display() const {
+        for (std::size_t i = 0; i < params_.size(); ++i) {
+            std::cout << params_[i].name << ": " << values_[i] << "\n";
+        }
+    }
+
+  private:
+    // Writes the values that differ from what the weights hold, so a local search step touches
+    // one weight, and invalidates the evaluation caches only if something changed
+    void apply_changes() {
+        bool changed = false;
+        for (std::size_t i = 0; i < params_.size(); ++i) {
+            if (values_[i] != applied_[i]) {
+                params_[i].set(values_[i]);
+                applied_[i] = values_[i];
+                changed = true;
+            }
+        }
+        if (changed) {
+            eval::invalidate_caches();
+        }
+    }
+
+    const TuningData& data_;
+    std::vector<Parameter> params_;
+    std::vector<int> values_;
+    std::vector<int> applied_;
+    int threads_;
+    std::vector<int> scores_;
+};
+
+} // namespace tune
+
+// tune <epd or packed path> [threads]
+inline void tune_handler(std::istringstream& line_stream) {
+    std::string path;
+    line_stream >> std::quoted(path);
+    int threads = int(std::thread::hardware_concurrency());
+    line_stream >> threads;
+    threads = std::max(1, threads);
+
+    auto data = tune::TuningData::from_file(path, threads);
+    if (!data) {
+        std::cout << "info string failed to read " << path << "\n";
+        return;
+    }
+    std::cout << "tuning " << data->positions.size << " positions on " << threads
+              << " threads...\n";
+    tune::Tuner tuner{*data, tune::tunable_parameters(), threads};
     std::cout << "Initial error: " << tuner.error() << "\n";
     tuner.local_tune();
     tuner.display();